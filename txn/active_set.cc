@@ -0,0 +1,43 @@
+#include "txn/active_set.h"
+
+ActiveSet::Snapshot ActiveSet::Insert(Txn* txn) {
+  Snapshot snapshot(head_, seq_);
+  head_ = shared_ptr<Node>(new Node(txn, head_));
+  nodes_[txn] = head_.get();
+  live_++;
+  return snapshot;
+}
+
+void ActiveSet::Erase(Txn* txn) {
+  unordered_map<Txn*, Node*>::iterator it = nodes_.find(txn);
+  if (it == nodes_.end())
+    DIE("Erasing txn that is not in the active set.");
+
+  it->second->erased_.store(++seq_, std::memory_order_release);
+  nodes_.erase(it);
+  live_--;
+  dead_++;
+  MaybeCompact();
+}
+
+// Minimum number of erased entries before compaction is considered, so that
+// small sets are not rebuilt on every erasure.
+#define MIN_COMPACTION 32
+
+void ActiveSet::MaybeCompact() {
+  if (dead_ < MIN_COMPACTION || dead_ <= live_)
+    return;
+
+  // Copy live entries into a fresh list. Nodes in the old list are never
+  // modified again, which is what any snapshot still holding them expects:
+  // every later erasure has a sequence number greater than theirs.
+  shared_ptr<Node> head;
+  for (Node* node = head_.get(); node != NULL; node = node->next_.get()) {
+    if (node->erased_.load(std::memory_order_relaxed) != 0)
+      continue;
+    head = shared_ptr<Node>(new Node(node->txn_, head));
+    nodes_[node->txn_] = head.get();
+  }
+  head_ = head;
+  dead_ = 0;
+}
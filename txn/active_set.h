@@ -0,0 +1,133 @@
+// Persistent active set used by OCC with parallel validation (OCC-P).
+//
+// Every transaction that enters the validation phase must be checked against
+// all transactions that were validating when it started. Rather than copying
+// the whole set for each validator, ActiveSet keeps an immutable,
+// reference-counted list of entries. Inserting an entry prepends a new node,
+// so a Snapshot is simply a pointer to the head of the list plus the sequence
+// number at which it was taken. Erased entries are marked with the sequence
+// number of their erasure and are filtered out by any Snapshot taken after
+// that point. Nodes are shared between all snapshots that can see them and
+// are freed when the last snapshot referencing them goes away.
+
+#ifndef _ACTIVE_SET_H_
+#define _ACTIVE_SET_H_
+
+#include <atomic>
+#include <memory>
+#include <tr1/unordered_map>
+
+#include "txn/common.h"
+
+using std::shared_ptr;
+using std::tr1::unordered_map;
+
+class Txn;
+
+class ActiveSet {
+ private:
+  struct Node;
+
+ public:
+  // Immutable view of the active set at the time it was taken. Snapshots are
+  // cheap to copy (a single reference count increment) and may be read from
+  // any thread.
+  class Snapshot {
+   public:
+    Snapshot() : seq_(0) {}
+
+    // Iterates over the transactions that were active when the snapshot was
+    // taken. Usage:
+    //
+    //   for (Snapshot::Iterator it = s.Begin(); !it.Done(); it.Next())
+    //     ... it.txn() ...
+    class Iterator {
+     public:
+      Txn* txn() const { return node_->txn_; }
+      bool Done() const { return node_ == NULL; }
+      void Next() {
+        node_ = node_->next_.get();
+        Skip();
+      }
+
+     private:
+      friend class Snapshot;
+      Iterator(const Node* node, uint64 seq) : node_(node), seq_(seq) {
+        Skip();
+      }
+
+      // Advances past entries that had already been erased at 'seq_'.
+      void Skip() {
+        while (node_ != NULL && !node_->VisibleAt(seq_))
+          node_ = node_->next_.get();
+      }
+
+      const Node* node_;
+      uint64 seq_;
+    };
+
+    Iterator Begin() const { return Iterator(head_.get(), seq_); }
+
+   private:
+    friend class ActiveSet;
+    Snapshot(const shared_ptr<Node>& head, uint64 seq)
+        : head_(head), seq_(seq) {}
+
+    shared_ptr<Node> head_;
+    uint64 seq_;
+  };
+
+  ActiveSet() : seq_(0), live_(0), dead_(0) {}
+
+  // Returns a snapshot of the current active set, then adds 'txn' to it.
+  //
+  // Requires: 'txn' is not currently in the active set.
+  // Note: Insert and Erase may only be called from a single (scheduler)
+  //       thread.
+  Snapshot Insert(Txn* txn);
+
+  // Removes 'txn' from the active set. Snapshots taken before this call still
+  // contain 'txn'.
+  void Erase(Txn* txn);
+
+  // Returns the number of transactions currently in the active set.
+  int Size() const { return live_; }
+
+ private:
+  struct Node {
+    Node(Txn* txn, const shared_ptr<Node>& next)
+        : txn_(txn), erased_(0), next_(next) {}
+
+    // Returns true if this entry was still active at sequence number 'seq'.
+    bool VisibleAt(uint64 seq) const {
+      uint64 erased = erased_.load(std::memory_order_acquire);
+      return erased == 0 || erased > seq;
+    }
+
+    Txn* txn_;
+
+    // Sequence number at which the entry was erased (0 while still active).
+    std::atomic<uint64> erased_;
+
+    shared_ptr<Node> next_;
+  };
+
+  // Rebuilds the list from live entries only, once erased entries outnumber
+  // live ones. Existing snapshots keep the old list alive until released.
+  void MaybeCompact();
+
+  // Head of the most recent version of the list.
+  shared_ptr<Node> head_;
+
+  // Sequence number of the most recent Insert/Erase.
+  uint64 seq_;
+
+  // Live node for each transaction currently in the set.
+  unordered_map<Txn*, Node*> nodes_;
+
+  // Number of live and erased-but-still-linked entries reachable from head_.
+  int live_;
+  int dead_;
+};
+
+#endif  // _ACTIVE_SET_H_
@@ -0,0 +1,75 @@
+#include "txn/active_set.h"
+
+#include <set>
+
+#include "utils/testing.h"
+
+using std::set;
+
+// Collects the contents of a snapshot into a std::set for easy comparison.
+set<Txn*> Contents(const ActiveSet::Snapshot& s) {
+  set<Txn*> result;
+  for (ActiveSet::Snapshot::Iterator it = s.Begin(); !it.Done(); it.Next())
+    result.insert(it.txn());
+  return result;
+}
+
+TEST(ActiveSet_SnapshotIsolation) {
+  ActiveSet active;
+
+  Txn* t1 = reinterpret_cast<Txn*>(1);
+  Txn* t2 = reinterpret_cast<Txn*>(2);
+  Txn* t3 = reinterpret_cast<Txn*>(3);
+
+  // t1 validates against nothing.
+  ActiveSet::Snapshot s1 = active.Insert(t1);
+  EXPECT_EQ(0, Contents(s1).size());
+
+  // t2 validates against t1.
+  ActiveSet::Snapshot s2 = active.Insert(t2);
+  EXPECT_EQ(1, Contents(s2).size());
+  EXPECT_TRUE(Contents(s2).count(t1));
+
+  // t1 finishes. s2 must still see it, but t3 must not.
+  active.Erase(t1);
+  EXPECT_TRUE(Contents(s2).count(t1));
+  ActiveSet::Snapshot s3 = active.Insert(t3);
+  EXPECT_EQ(1, Contents(s3).size());
+  EXPECT_TRUE(Contents(s3).count(t2));
+  EXPECT_EQ(2, active.Size());
+
+  END;
+}
+
+TEST(ActiveSet_Compaction) {
+  ActiveSet active;
+
+  Txn* t1 = reinterpret_cast<Txn*>(1);
+  ActiveSet::Snapshot old = active.Insert(t1);
+  ActiveSet::Snapshot with_t1 = active.Insert(reinterpret_cast<Txn*>(2));
+
+  // Churn enough entries through the set to trigger compaction.
+  for (uint64 i = 100; i < 1000; i++) {
+    active.Insert(reinterpret_cast<Txn*>(i));
+    active.Erase(reinterpret_cast<Txn*>(i));
+  }
+  EXPECT_EQ(2, active.Size());
+
+  // Snapshots taken before compaction are unaffected by it, and entries that
+  // survived compaction can still be erased.
+  active.Erase(t1);
+  EXPECT_EQ(0, Contents(old).size());
+  EXPECT_EQ(1, Contents(with_t1).size());
+  EXPECT_TRUE(Contents(with_t1).count(t1));
+
+  ActiveSet::Snapshot now = active.Insert(t1);
+  EXPECT_EQ(1, Contents(now).size());
+  EXPECT_TRUE(Contents(now).count(reinterpret_cast<Txn*>(2)));
+
+  END;
+}
+
+int main(int argc, char** argv) {
+  ActiveSet_SnapshotIsolation();
+  ActiveSet_Compaction();
+}
@@ -0,0 +1,58 @@
+#include "txn/invalidator.h"
+
+void Invalidator::Watch(Txn* txn) {
+  mutex_.Lock();
+  KeySet* sets[] = {&txn->readset_, &txn->writeset_};
+  for (int s = 0; s < 2; s++) {
+    for (KeySet::iterator it = sets[s]->begin(); it != sets[s]->end();
+         ++it) {
+      if (!txn->blindset_.count(*it))
+        watchers_[*it].insert(txn);
+    }
+  }
+  mutex_.Unlock();
+}
+
+void Invalidator::Unwatch(Txn* txn) {
+  mutex_.Lock();
+  KeySet* sets[] = {&txn->readset_, &txn->writeset_};
+  for (int s = 0; s < 2; s++) {
+    for (KeySet::iterator it = sets[s]->begin(); it != sets[s]->end();
+         ++it) {
+      unordered_map<Key, set<Txn*> >::iterator w = watchers_.find(*it);
+      if (w == watchers_.end())
+        continue;
+      w->second.erase(txn);
+      if (w->second.empty())
+        watchers_.erase(w);
+    }
+  }
+  mutex_.Unlock();
+}
+
+void Invalidator::Updated(const Key& key, double time) {
+  updates_.Push(std::make_pair(key, time));
+}
+
+bool Invalidator::Notify() {
+  pair<Key, double> update;
+  if (!updates_.Pop(&update))
+    return false;
+
+  mutex_.Lock();
+  do {
+    unordered_map<Key, set<Txn*> >::iterator w = watchers_.find(update.first);
+    if (w == watchers_.end())
+      continue;
+
+    // Txns that started after the update may have seen it, and would pass
+    // validation.
+    for (set<Txn*>::iterator it = w->second.begin(); it != w->second.end();
+         ++it) {
+      if ((*it)->occ_start_time_ < update.second)
+        (*it)->doomed_ = true;
+    }
+  } while (updates_.Pop(&update));
+  mutex_.Unlock();
+  return true;
+}
@@ -0,0 +1,58 @@
+// Background invalidation for the optimistic modes (OCC and OCC-P).
+//
+// An optimistic txn whose readset or writeset is overwritten while it runs
+// can no longer pass validation, but would normally only find out after
+// running to completion. The Invalidator keeps track of which running txns
+// access which keys. Writers report each record they update, and a background
+// thread dooms every watched txn that started before the update and accesses
+// that record, so that it stops working and can be restarted right away.
+
+#ifndef _INVALIDATOR_H_
+#define _INVALIDATOR_H_
+
+#include <set>
+#include <tr1/unordered_map>
+#include <utility>
+
+#include "txn/common.h"
+#include "txn/txn.h"
+#include "utils/atomic.h"
+#include "utils/mutex.h"
+
+using std::pair;
+using std::set;
+using std::tr1::unordered_map;
+
+class Invalidator {
+ public:
+  // Starts watching every key in '*txn's readset and writeset, except blind
+  // writes, on behalf of the attempt that started executing at
+  // txn->occ_start_time_.
+  void Watch(Txn* txn);
+
+  // Stops watching '*txn'. Once this returns, the Invalidator never touches
+  // '*txn' again.
+  void Unwatch(Txn* txn);
+
+  // Reports that the record with the specified key was updated at 'time'.
+  // May be called from any thread.
+  void Updated(const Key& key, double time);
+
+  // Dooms the watched txns affected by every update reported so far. Returns
+  // false if there were no new updates.
+  //
+  // Note: Should be called repeatedly from a single background thread.
+  bool Notify();
+
+ private:
+  // Updates that have been reported but not yet handled.
+  AtomicQueue<pair<Key, double> > updates_;
+
+  // Watched txns accessing each key.
+  unordered_map<Key, set<Txn*> > watchers_;
+
+  // Guards 'watchers_'.
+  Mutex mutex_;
+};
+
+#endif  // _INVALIDATOR_H_
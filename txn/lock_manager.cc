@@ -27,11 +27,7 @@ bool LockManagerA::WriteLock(Txn* txn, const Key& key) {
   if (lock_table_[key]->size() == 1) {
     return true;
   } else {
-    if (txn_waits_.count(txn)) {
-      txn_waits_[txn] = 1;
-    } else {
-     txn_waits_[txn]++;
-    }
+    txn_waits_[txn]++;
     return false;
   }
 }
@@ -44,6 +40,12 @@ bool LockManagerA::ReadLock(Txn* txn, const Key& key) {
 }
 
 
+bool LockManagerA::CommuteLock(Txn* txn, const Key& key) {
+  // Likewise, commutative updates simply take an exclusive lock.
+  return WriteLock(txn, key);
+}
+
+
 void LockManagerA::Release(Txn* txn, const Key& key) {
   // Whether the removed trasaction had a lock
   bool hadLock;
@@ -104,18 +106,25 @@ bool LockManagerB::WriteLock(Txn* txn, const Key& key) {
     return true;
   } else {
     // initialize or increment the number of locks to wait for
-    if (txn_waits_.count(txn))
-      txn_waits_[txn] = 1;
-    else
-      txn_waits_[txn]++;
+    txn_waits_[txn]++;
     return false;
   }
 }
 
 
 bool LockManagerB::ReadLock(Txn* txn, const Key& key) {
+  return SharedLock(txn, key, SHARED);
+}
+
+
+bool LockManagerB::CommuteLock(Txn* txn, const Key& key) {
+  return SharedLock(txn, key, COMMUTATIVE);
+}
+
+
+bool LockManagerB::SharedLock(Txn* txn, const Key& key, LockMode mode) {
   // Make a new LockRequest
-  LockRequest l(SHARED, txn);
+  LockRequest l(mode, txn);
 
   // Initialize lock_table_
   if (lock_table_.count(key)) {
@@ -127,50 +136,48 @@ bool LockManagerB::ReadLock(Txn* txn, const Key& key) {
 
   // Increment position in txn_waits_ if lock is not acquired
   deque<LockRequest> *requests = lock_table_[key];
-  deque<LockRequest>::iterator i;
-  for (i = requests->begin(); i != requests->end(); i++) {
-    if (i->mode_ == EXCLUSIVE) {
-      if (txn_waits_.count(txn))
-        txn_waits_[txn] = 1;
-      else
-        txn_waits_[txn]++;
-      return false;
-    }
-  }
-  return true;
+  if (Holders(*requests) == static_cast<int>(requests->size()))
+    return true;
+  txn_waits_[txn]++;
+  return false;
+}
+
+
+int LockManagerB::Holders(const deque<LockRequest>& requests) {
+  if (requests.empty())
+    return 0;
+  if (requests.front().mode_ == EXCLUSIVE)
+    return 1;
+
+  // A prefix of SHARED or COMMUTATIVE requests hold the lock together.
+  int holders = 1;
+  while (holders < static_cast<int>(requests.size()) &&
+         requests[holders].mode_ == requests.front().mode_)
+    holders++;
+  return holders;
 }
 
 
 void LockManagerB::Release(Txn* txn, const Key& key) {
   // Lock requests for the key
   deque<LockRequest> *requests = lock_table_[key];
+  int before = Holders(*requests);
 
   // Remove the txn from the requests list
   deque<LockRequest>::iterator i;
   for (i = requests->begin(); i != requests->end(); i++) {
     // Transaction was found
     if (i->txn_ == txn) {
-      if ((i+1) != requests->end()) {
-        bool atStart = i == requests->begin();
-
-        // _SE -> start E
-        // _EE -> start E
-        if (atStart && ((i+1)->mode_ == EXCLUSIVE)) {
-          if (--txn_waits_[(i+1)->txn_] == 0)
-            ready_txns_->push_back((i+1)->txn_);
-        }
-
-        // _ES -> start longest substring of sses
-        // SES -> start longest substring of sses
-        if ((i->mode_ == EXCLUSIVE) && (
-          (atStart && (i+1)->mode_ == SHARED) ||
-          ((!atStart && (i-1)->mode_ == SHARED) && ((i+1)->mode_ == SHARED)))) {
-              deque<LockRequest>::iterator j;
-            for (j = i + 1; j != requests->end() && j->mode_ == SHARED; j++)
-              if (--txn_waits_[j->txn_] == 0) ready_txns_->push_back(j->txn_);
-        }
-      }
+      int removed = i - requests->begin();
       requests->erase(i);
+
+      // Start every request that holds the lock now but did not before.
+      int after = Holders(*requests);
+      for (int j = 0; j < after; j++) {
+        int old = (j < removed) ? j : j + 1;
+        if (old >= before && --txn_waits_[(*requests)[j].txn_] == 0)
+          ready_txns_->push_back((*requests)[j].txn_);
+      }
       break;
     }
   }
@@ -182,19 +189,12 @@ LockMode LockManagerB::Status(const Key& key, vector<Txn*>* owners) {
   owners->clear();
 
   // Nothing to do
-  if (lock_table_[key]->size() == 0) return UNLOCKED;
-
-  // Fill the vector with the transaction with an exclusive lock
-  if (lock_table_[key]->begin()->mode_ == EXCLUSIVE) {
-    owners->push_back(lock_table_[key]->begin()->txn_);
-    return EXCLUSIVE;
-  }
-
-  // Fill the vector with transactions with shared locks
-  deque<LockRequest>::iterator i;
   deque<LockRequest> *requests = lock_table_[key];
-  for (i = requests->begin(); i != requests->end() && i->mode_ == SHARED; i++) {
-    owners->push_back(i->txn_);
-  }
-  return SHARED;
+  int holders = Holders(*requests);
+  if (holders == 0) return UNLOCKED;
+
+  // Fill the vector with the transaction(s) holding the lock
+  for (int i = 0; i < holders; i++)
+    owners->push_back((*requests)[i].txn_);
+  return requests->front().mode_;
 }
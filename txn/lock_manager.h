@@ -20,11 +20,13 @@ using std::tr1::unordered_map;
 class Txn;
 
 // This interface supports locks being held in both read/shared and
-// write/exclusive modes.
+// write/exclusive modes, as well as a commutative mode shared by txns that
+// only apply commutative updates (see 'Txn::Add()').
 enum LockMode {
   UNLOCKED = 0,
   SHARED = 1,
   EXCLUSIVE = 2,
+  COMMUTATIVE = 3,
 };
 
 class LockManager {
@@ -47,6 +49,14 @@ class LockManager {
   //           this txn and key.
   virtual bool WriteLock(Txn* txn, const Key& key) = 0;
 
+  // Attempts to grant a commutative lock to the specified transaction. Any
+  // number of txns may hold one at once, but not alongside SHARED or
+  // EXCLUSIVE locks. Returns true if lock is immediately granted, else
+  // returns false.
+  //
+  // Requires: No lock has previously been requested with this txn and key.
+  virtual bool CommuteLock(Txn* txn, const Key& key) = 0;
+
   // Releases lock held by 'txn' on 'key', or cancels any pending request for
   // a lock on 'key' by 'txn'. If 'txn' held an EXCLUSIVE lock on 'key' (or was
   // the sole holder of a SHARED lock on 'key'), then the next request(s) in the
@@ -63,7 +73,8 @@ class LockManager {
 
   // Sets '*owners' to contain the txn IDs of all txns holding the lock, and
   // returns the current LockMode of the lock: UNLOCKED if it is not currently
-  // held, SHARED or EXCLUSIVE if it is, depending on the current state.
+  // held, SHARED, EXCLUSIVE or COMMUTATIVE if it is, depending on the current
+  // state.
   virtual LockMode Status(const Key& key, vector<Txn*>* owners) = 0;
 
  protected:
@@ -74,8 +85,9 @@ class LockManager {
   //  (a) first element in the deque specifies the owner if that item is a
   //      request for an EXCLUSIVE lock, or
   //
-  //  (b) a SHARED lock is held by all elements of the longest prefix of the
-  //      deque containing only SHARED lock requests.
+  //  (b) a SHARED (or COMMUTATIVE) lock is held by all elements of the
+  //      longest prefix of the deque containing only SHARED (or COMMUTATIVE)
+  //      lock requests.
   //
   // For example, if lock_table_["key1"] points to a deque containing
   //
@@ -119,11 +131,13 @@ class LockManagerA : public LockManager {
 
   virtual bool ReadLock(Txn* txn, const Key& key);
   virtual bool WriteLock(Txn* txn, const Key& key);
+  virtual bool CommuteLock(Txn* txn, const Key& key);
   virtual void Release(Txn* txn, const Key& key);
   virtual LockMode Status(const Key& key, vector<Txn*>* owners);
 };
 
-// Version of the LockManager implementing both shared and exclusive locks.
+// Version of the LockManager implementing shared, exclusive and commutative
+// locks.
 class LockManagerB : public LockManager {
  public:
   explicit LockManagerB(deque<Txn*>* ready_txns);
@@ -131,8 +145,18 @@ class LockManagerB : public LockManager {
 
   virtual bool ReadLock(Txn* txn, const Key& key);
   virtual bool WriteLock(Txn* txn, const Key& key);
+  virtual bool CommuteLock(Txn* txn, const Key& key);
   virtual void Release(Txn* txn, const Key& key);
   virtual LockMode Status(const Key& key, vector<Txn*>* owners);
+
+ private:
+  // Requests a lock in 'mode' (SHARED or COMMUTATIVE), which is granted at
+  // once iff every request already in the queue is in the same mode.
+  bool SharedLock(Txn* txn, const Key& key, LockMode mode);
+
+  // Returns the number of requests at the front of 'requests' that currently
+  // hold the lock.
+  static int Holders(const deque<LockRequest>& requests);
 };
 
 #endif  // _LOCK_MANAGER_H_
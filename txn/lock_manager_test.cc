@@ -186,10 +186,50 @@ TEST(LockManagerB_LocksReleasedOutOfOrder) {
   END;
 }
 
+TEST(LockManagerB_CommutativeLocks) {
+  deque<Txn*> ready_txns;
+  LockManagerB lm(&ready_txns);
+  vector<Txn*> owners;
+
+  Txn* t1 = reinterpret_cast<Txn*>(1);
+  Txn* t2 = reinterpret_cast<Txn*>(2);
+  Txn* t3 = reinterpret_cast<Txn*>(3);
+  Txn* t4 = reinterpret_cast<Txn*>(4);
+
+  // Txns 1 and 2 share a commutative lock.
+  EXPECT_TRUE(lm.CommuteLock(t1, 101));
+  EXPECT_TRUE(lm.CommuteLock(t2, 101));
+  EXPECT_EQ(COMMUTATIVE, lm.Status(101, &owners));
+  EXPECT_EQ(2, owners.size());
+
+  // Txn 3's read lock conflicts with it, and txn 4's commutative lock queues
+  // behind txn 3.
+  EXPECT_FALSE(lm.ReadLock(t3, 101));
+  EXPECT_FALSE(lm.CommuteLock(t4, 101));
+
+  // Txn 3 is only granted its read lock once both holders release.
+  lm.Release(t1, 101);
+  EXPECT_EQ(0, ready_txns.size());
+  lm.Release(t2, 101);
+  EXPECT_EQ(SHARED, lm.Status(101, &owners));
+  EXPECT_EQ(1, ready_txns.size());
+  EXPECT_EQ(t3, ready_txns.at(0));
+
+  lm.Release(t3, 101);
+  EXPECT_EQ(COMMUTATIVE, lm.Status(101, &owners));
+  EXPECT_EQ(1, owners.size());
+  EXPECT_EQ(t4, owners[0]);
+  EXPECT_EQ(2, ready_txns.size());
+  EXPECT_EQ(t4, ready_txns.at(1));
+
+  END;
+}
+
 int main(int argc, char** argv) {
   LockManagerA_SimpleLocking();
   LockManagerA_LocksReleasedOutOfOrder();
   LockManagerB_SimpleLocking();
   LockManagerB_LocksReleasedOutOfOrder();
+  LockManagerB_CommutativeLocks();
 }
 
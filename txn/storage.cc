@@ -1,6 +1,38 @@
 #include "txn/storage.h"
 
+#include <sched.h>
+#include <unistd.h>
+
+// Number of commutative updates a record must receive within SPLIT_WINDOW
+// seconds to be split.
+#define SPLIT_THRESHOLD 16
+#define SPLIT_WINDOW 0.01
+
+Storage::Storage()
+    : splitting_(false), slice_count_(sysconf(_SC_NPROCESSORS_ONLN)),
+      split_count_(0) {
+  if (slice_count_ < 1)
+    slice_count_ = 1;
+}
+
+Storage::~Storage() {
+  for (unordered_map<Key, Slice*>::iterator it = split_.begin();
+       it != split_.end(); ++it) {
+    delete[] it->second;
+  }
+}
+
 bool Storage::Read(Key key, Value* result) {
+  Reconcile(key);
+  return ReadJoined(key, result);
+}
+
+void Storage::Write(Key key, Value value) {
+  Reconcile(key);
+  WriteJoined(key, value, GetTime());
+}
+
+bool Storage::ReadJoined(Key key, Value* result) {
   if (data_.count(key)) {
     *result = data_[key];
     return true;
@@ -9,13 +41,317 @@ bool Storage::Read(Key key, Value* result) {
   }
 }
 
-void Storage::Write(Key key, Value value) {
+void Storage::WriteJoined(Key key, Value value, double time) {
   data_[key] = value;
-  timestamps_[key] = GetTime();
+  timestamps_[key] = time;
+}
+
+void Storage::Apply(Key key, const Delta& delta) {
+  // Updates of a split record only touch the caller's slice.
+  if (split_count_ > 0) {
+    split_mutex_.ReadLock();
+    unordered_map<Key, Slice*>::iterator it = split_.find(key);
+    if (it != split_.end()) {
+      int cpu = sched_getcpu();
+      Slice& slice = it->second[(cpu < 0 ? 0 : cpu) % slice_count_];
+      slice.mutex_.Lock();
+      if (slice.dirty_) {
+        slice.delta_.arg_ =
+            ApplyDelta(delta.op_, true, slice.delta_.arg_, delta.arg_);
+      } else {
+        slice.delta_ = delta;
+        slice.dirty_ = true;
+      }
+      slice.time_ = GetTime();
+      slice.mutex_.Unlock();
+      split_mutex_.Unlock();
+      return;
+    }
+    split_mutex_.Unlock();
+  }
+
+  mutex_.Lock();
+  Value value = 0;
+  bool exists = ReadJoined(key, &value);
+  double now = GetTime();
+  WriteJoined(key, ApplyDelta(delta.op_, exists, value, delta.arg_), now);
+
+  if (splitting_) {
+    std::pair<int, double>& heat = heat_[key];
+    if (now > heat.second + SPLIT_WINDOW)
+      heat = std::make_pair(0, now);
+    if (++heat.first >= SPLIT_THRESHOLD) {
+      heat_.erase(key);
+      split_mutex_.WriteLock();
+      split_[key] = new Slice[slice_count_];
+      split_count_++;
+      split_mutex_.Unlock();
+    }
+  }
+  mutex_.Unlock();
+}
+
+void Storage::Reconcile(Key key) {
+  if (split_count_ == 0 || !Split(key))
+    return;
+
+  mutex_.Lock();
+  split_mutex_.WriteLock();
+  unordered_map<Key, Slice*>::iterator it = split_.find(key);
+  if (it != split_.end()) {
+    Value value = 0;
+    bool exists = ReadJoined(key, &value);
+    double time = JoinedTimestamp(key);
+    for (int i = 0; i < slice_count_; i++) {
+      Slice& slice = it->second[i];
+      if (!slice.dirty_)
+        continue;
+      value = ApplyDelta(slice.delta_.op_, exists, value, slice.delta_.arg_);
+      exists = true;
+      time = std::max(time, slice.time_);
+    }
+    if (exists)
+      WriteJoined(key, value, time);
+
+    delete[] it->second;
+    split_.erase(it);
+    split_count_--;
+  }
+  split_mutex_.Unlock();
+  mutex_.Unlock();
 }
 
 double Storage::Timestamp(Key key) {
+  // Reconciling first makes updates applied to slices count as well.
+  Reconcile(key);
+  return JoinedTimestamp(key);
+}
+
+bool Storage::Split(Key key) {
+  split_mutex_.ReadLock();
+  bool split = split_.count(key);
+  split_mutex_.Unlock();
+  return split;
+}
+
+double Storage::JoinedTimestamp(Key key) {
   if (timestamps_.count(key) == 0)
     return 0;
   return timestamps_[key];
 }
+
+void SnapshotLog::Overwrite(Key key, bool exists, Value value, uint64 ts,
+                            uint64 low_water) {
+  mutex_.Lock();
+  deque<Entry>& entries = data_[key];
+
+  // A snapshot taken at or after 'low_water' only reads entries overwritten
+  // later than that.
+  while (!entries.empty() && entries.front().ts_ <= low_water)
+    entries.pop_front();
+
+  entries.push_back(Entry(exists, value, ts));
+  mutex_.Unlock();
+}
+
+bool SnapshotLog::Read(Key key, uint64 ts, bool* exists, Value* value) {
+  mutex_.Lock();
+  unordered_map<Key, deque<Entry> >::iterator it = data_.find(key);
+  if (it != data_.end()) {
+    // The first overwrite after 'ts' replaced what the snapshot should see.
+    deque<Entry>& entries = it->second;
+    for (deque<Entry>::iterator e = entries.begin(); e != entries.end(); ++e) {
+      if (e->ts_ > ts) {
+        *exists = e->exists_;
+        *value = e->value_;
+        mutex_.Unlock();
+        return true;
+      }
+    }
+  }
+  mutex_.Unlock();
+  return false;
+}
+
+void SnapshotLog::Clear() {
+  mutex_.Lock();
+  if (!data_.empty())
+    data_.clear();
+  mutex_.Unlock();
+}
+
+bool MVStorage::Read(Key key, Value* result, uint64 ts) {
+  mutex_.ReadLock();
+  unordered_map<Key, deque<Version> >::iterator it = data_.find(key);
+  if (it != data_.end()) {
+    // Scan from the newest version back to the first one visible at 'ts'.
+    deque<Version>& versions = it->second;
+    for (deque<Version>::reverse_iterator v = versions.rbegin();
+         v != versions.rend(); ++v) {
+      if (v->ts_ <= ts) {
+        *result = v->value_;
+        mutex_.Unlock();
+        return true;
+      }
+    }
+  }
+  mutex_.Unlock();
+  return false;
+}
+
+void MVStorage::Write(Key key, Value value, uint64 ts, uint64 low_water) {
+  mutex_.WriteLock();
+  deque<Version>& versions = data_[key];
+
+  // Every snapshot still in use sees the newest version committed at or
+  // before 'low_water' (or something newer), so anything older can go.
+  while (versions.size() >= 2 && versions[1].ts_ <= low_water)
+    versions.pop_front();
+
+  versions.push_back(Version(value, ts));
+  mutex_.Unlock();
+}
+
+uint64 MVStorage::Timestamp(Key key) {
+  mutex_.ReadLock();
+  uint64 ts = 0;
+  unordered_map<Key, deque<Version> >::iterator it = data_.find(key);
+  if (it != data_.end() && !it->second.empty())
+    ts = it->second.back().ts_;
+  mutex_.Unlock();
+  return ts;
+}
+
+TOStorage::Record::Record() : rts_(0) {
+  // Every record starts out with a committed "does not exist" version, so
+  // that reads of missing records are timestamped like any other read.
+  versions_.push_back(Version(0));
+  versions_.back().pending_ = false;
+}
+
+TOStorage::TOStorage(bool multiversion) : multiversion_(multiversion) {
+  pthread_mutex_init(&mutex_, NULL);
+  pthread_cond_init(&resolved_, NULL);
+}
+
+TOStorage::~TOStorage() {
+  pthread_cond_destroy(&resolved_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+int TOStorage::Before(const deque<Version>& versions, uint64 ts) {
+  int i = versions.size() - 1;
+  while (i >= 0 && versions[i].wts_ >= ts)
+    i--;
+  return i;
+}
+
+int TOStorage::Newest(const deque<Version>& versions) {
+  int i = versions.size() - 1;
+  while (versions[i].pending_)
+    i--;
+  return i;
+}
+
+int TOStorage::At(const deque<Version>& versions, uint64 ts) {
+  for (uint32 i = 0; i < versions.size(); i++) {
+    if (versions[i].wts_ == ts)
+      return i;
+  }
+  DIE("No version of record written at " << ts);
+}
+
+bool TOStorage::Read(Key key, uint64 ts, Value* result, bool* rejected) {
+  pthread_mutex_lock(&mutex_);
+  Record& record = data_[key];
+  deque<Version>& versions = record.versions_;
+  int i;
+  while (true) {
+    // Under T/O, the newest committed version is the only one kept. If it was
+    // written after 'ts', the version we should have read is gone.
+    if (!multiversion_ && versions[Newest(versions)].wts_ > ts) {
+      *rejected = true;
+      pthread_mutex_unlock(&mutex_);
+      return false;
+    }
+
+    // Otherwise wait for the writer of the version we should see to commit or
+    // abort. Indices may shift in the meantime, so look it up again.
+    i = Before(versions, ts);
+    if (i < 0) {
+      *rejected = true;
+      pthread_mutex_unlock(&mutex_);
+      return false;
+    }
+    if (!versions[i].pending_)
+      break;
+    pthread_cond_wait(&resolved_, &mutex_);
+  }
+
+  Version& version = versions[i];
+  version.rts_ = std::max(version.rts_, ts);
+  record.rts_ = std::max(record.rts_, ts);
+  bool exists = version.exists_;
+  if (exists)
+    *result = version.value_;
+  pthread_mutex_unlock(&mutex_);
+  return exists;
+}
+
+bool TOStorage::Prewrite(Key key, uint64 ts) {
+  pthread_mutex_lock(&mutex_);
+  Record& record = data_[key];
+  deque<Version>& versions = record.versions_;
+
+  // Under T/O, a txn with a later timestamp has already read or overwritten
+  // the record. Under MVTO, one has read the version this write supersedes,
+  // when it should have seen this one. Either way, the write is too late if
+  // that version has already been discarded.
+  bool rejected = !multiversion_ &&
+                  (record.rts_ > ts || versions[Newest(versions)].wts_ > ts);
+  int i = -1;
+  if (!rejected) {
+    i = Before(versions, ts);
+    rejected = i < 0 || (multiversion_ && versions[i].rts_ > ts);
+  }
+
+  if (!rejected)
+    versions.insert(versions.begin() + i + 1, Version(ts));
+  pthread_mutex_unlock(&mutex_);
+  return !rejected;
+}
+
+void TOStorage::Commit(Key key, uint64 ts, Value value, uint64 low_water) {
+  pthread_mutex_lock(&mutex_);
+  deque<Version>& versions = data_[key].versions_;
+  Version& version = versions[At(versions, ts)];
+  version.value_ = value;
+  version.exists_ = true;
+  version.pending_ = false;
+
+  // Under T/O, only the newest committed version is kept (if that is not
+  // this one, the write is simply dropped). Under MVTO, every active txn reads
+  // the newest version committed before 'low_water' or something newer, so
+  // anything older can go.
+  int newest = Newest(versions);
+  if (multiversion_) {
+    while (newest >= 0 &&
+           (versions[newest].pending_ || versions[newest].wts_ >= low_water))
+      newest--;
+  }
+  for (int i = newest - 1; i >= 0; i--) {
+    if (!versions[i].pending_)
+      versions.erase(versions.begin() + i);
+  }
+
+  pthread_cond_broadcast(&resolved_);
+  pthread_mutex_unlock(&mutex_);
+}
+
+void TOStorage::Abort(Key key, uint64 ts) {
+  pthread_mutex_lock(&mutex_);
+  deque<Version>& versions = data_[key].versions_;
+  versions.erase(versions.begin() + At(versions, ts));
+  pthread_cond_broadcast(&resolved_);
+  pthread_mutex_unlock(&mutex_);
+}
@@ -4,19 +4,37 @@
 #define _STORAGE_H_
 
 #include <limits.h>
+#include <pthread.h>
 #include <tr1/unordered_map>
+#include <algorithm>
+#include <atomic>
 #include <deque>
 #include <map>
 
 #include "txn/common.h"
 #include "txn/txn.h"
+#include "utils/mutex.h"
 
 using std::tr1::unordered_map;
 using std::deque;
 using std::map;
 
+// Single-version storage used by all other modes.
+//
+// Optionally, records that receive a burst of commutative updates (see
+// 'Apply()') are split: each core gets a slice that accumulates its own
+// updates of the record, so concurrent updaters do not contend on it. The
+// first read, write or timestamp check of a split record reconciles it,
+// merging all slices back into the record, which stays joined until it gets
+// hot again.
 class Storage {
  public:
+  Storage();
+  ~Storage();
+
+  // Turns on splitting of hot records.
+  void EnableSplitting() { splitting_ = true; }
+
   // If there exists a record for the specified key, sets '*result' equal to
   // the value associated with the key and returns true, else returns false;
   bool Read(Key key, Value* result);
@@ -25,16 +43,225 @@ class Storage {
   // same key.
   void Write(Key key, Value value);
 
+  // Applies the commutative update 'delta' to the record with the specified
+  // key (creating it if necessary), or to the calling core's slice if the
+  // record is split. Concurrent calls are applied one at a time, so none of
+  // them is lost.
+  void Apply(Key key, const Delta& delta);
+
   // Returns the timestamp at which the record with the specified key was last
   // updated (returns 0 if the record has never been updated).
   double Timestamp(Key key);
 
+  // Returns true iff the record with the specified key is currently split.
+  bool Split(Key key);
+
  private:
   // Collection of <key, value> pairs.
   unordered_map<Key, Value> data_;
 
   // Timestamps at which each key was last updated.
   unordered_map<Key, double> timestamps_;
+
+  // Serializes 'Apply()' calls on joined records, and reconciliation.
+  Mutex mutex_;
+
+  // One core's pending updates of a split record.
+  struct Slice {
+    Slice() : dirty_(false), delta_(ADD, 0), time_(0) {}
+    Mutex mutex_;
+    bool dirty_;    // Whether 'delta_' holds any updates.
+    Delta delta_;   // This core's updates, combined.
+    double time_;   // Time of this core's last update.
+  };
+
+  // Merges the slices of the record with the specified key back into it, if
+  // it is split.
+  void Reconcile(Key key);
+
+  // Read/Write/Timestamp without reconciling first.
+  bool ReadJoined(Key key, Value* result);
+  void WriteJoined(Key key, Value value, double time);
+  double JoinedTimestamp(Key key);
+
+  // Whether hot records are split, and how many slices each one gets.
+  bool splitting_;
+  int slice_count_;
+
+  // Recent commutative updates of each joined record: how many there were,
+  // and when the first of them happened. Guarded by 'mutex_'.
+  unordered_map<Key, std::pair<int, double> > heat_;
+
+  // Slices of each split record, and how many records are split. Applying an
+  // update to a slice holds 'split_mutex_' for reading; splitting and
+  // reconciling hold it for writing.
+  unordered_map<Key, Slice*> split_;
+  std::atomic<int> split_count_;
+  MutexRW split_mutex_;
+};
+
+// Values that the records of a single-version 'Storage' held before being
+// overwritten, kept for snapshots taken before the overwrite. This lets a
+// worker read the state as of a snapshot straight from 'Storage' while the
+// scheduler thread keeps applying writes: the scheduler logs what a record
+// holds before overwriting it, and the reader checks the log after reading
+// the record. Entries are logged by the scheduler thread and read by worker
+// threads, so all accesses are guarded by a mutex.
+class SnapshotLog {
+ public:
+  // Records that the record with the specified key held 'value' (or did not
+  // exist, if '!exists') until it was overwritten at 'ts', which must be
+  // greater than that of any earlier overwrite. Entries that no snapshot
+  // taken at or after 'low_water' can need are discarded.
+  void Overwrite(Key key, bool exists, Value value, uint64 ts,
+                 uint64 low_water);
+
+  // If the record with the specified key was overwritten after 'ts', sets
+  // '*exists' and '*value' to what it held at 'ts' and returns true. Returns
+  // false if it was not (so the record itself still holds that).
+  bool Read(Key key, uint64 ts, bool* exists, Value* value);
+
+  // Discards all entries, once no snapshot is in use.
+  void Clear();
+
+ private:
+  struct Entry {
+    Entry(bool exists, Value value, uint64 ts)
+        : exists_(exists), value_(value), ts_(ts) {}
+    bool exists_;
+    Value value_;
+    uint64 ts_;  // When the record was overwritten.
+  };
+
+  // Overwritten values of each record, oldest first.
+  unordered_map<Key, deque<Entry> > data_;
+
+  // Guards 'data_'.
+  Mutex mutex_;
+};
+
+// Multiversion storage used by the snapshot isolation modes. Each key maps to
+// a list of versions, ordered by the logical timestamp at which the txn that
+// wrote them committed. Versions are read by worker threads and installed by
+// the scheduler thread, so all accesses are guarded by a reader/writer lock.
+class MVStorage {
+ public:
+  // If a version of the record with the specified key was committed at or
+  // before 'ts', sets '*result' equal to the newest such version's value and
+  // returns true, else returns false.
+  bool Read(Key key, Value* result, uint64 ts);
+
+  // Installs a new version of the record <key, value> committed at 'ts',
+  // which must be greater than that of any existing version. Versions that
+  // are not visible to any snapshot taken at or after 'low_water' are
+  // discarded.
+  void Write(Key key, Value value, uint64 ts, uint64 low_water);
+
+  // Returns the commit timestamp of the newest version of the record with the
+  // specified key (returns 0 if the record has never been written).
+  uint64 Timestamp(Key key);
+
+ private:
+  struct Version {
+    Version(Value value, uint64 ts) : value_(value), ts_(ts) {}
+    Value value_;
+    uint64 ts_;
+  };
+
+  // Versions of each record, oldest first.
+  unordered_map<Key, deque<Version> > data_;
+
+  // Guards 'data_'.
+  MutexRW mutex_;
+};
+
+// Storage used by the timestamp ordering modes (T/O and MVTO). Every txn
+// carries a unique timestamp, and each record keeps the timestamps of the txns
+// that wrote and read it. An access that arrives too late to fit into the
+// timestamp order is rejected as soon as it happens, so the txn can be
+// restarted right away.
+//
+// A txn's first write to a key registers a pending version (a prewrite),
+// whose value is filled in at commit. Readers that should see a pending
+// version wait for its writer to commit or abort. Since they only ever wait
+// for txns with smaller timestamps, waits cannot form a cycle.
+//
+// In single-version mode (T/O), only the newest committed version is kept, so
+// a read that should have happened before it is rejected. In multiversion
+// mode (MVTO), older versions are kept for as long as an active txn may read
+// them, so reads are never rejected; a write is only rejected if a txn with a
+// later timestamp has already read the version that it would supersede.
+class TOStorage {
+ public:
+  explicit TOStorage(bool multiversion);
+  ~TOStorage();
+
+  // Reads the record with the specified key on behalf of the txn with
+  // timestamp 'ts', blocking while the version it should see is pending. If
+  // the read is rejected, sets '*rejected' and returns false. Otherwise, if
+  // the record exists, sets '*result' equal to its value and returns true,
+  // else returns false.
+  bool Read(Key key, uint64 ts, Value* result, bool* rejected);
+
+  // Registers a prewrite of the record with the specified key by the txn with
+  // timestamp 'ts'. Returns false if the write is rejected.
+  bool Prewrite(Key key, uint64 ts);
+
+  // Installs 'value' as the version prewritten at 'ts'. Versions that no txn
+  // with a timestamp of at least 'low_water' can read are discarded.
+  void Commit(Key key, uint64 ts, Value value, uint64 low_water);
+
+  // Discards the version prewritten at 'ts'.
+  void Abort(Key key, uint64 ts);
+
+ private:
+  struct Version {
+    explicit Version(uint64 wts)
+        : wts_(wts), rts_(0), value_(0), exists_(false), pending_(true) {}
+
+    // Timestamps of the txn that wrote the version, and of the latest txn
+    // that read it.
+    uint64 wts_;
+    uint64 rts_;
+
+    Value value_;
+
+    // False for a record that has not been written yet.
+    bool exists_;
+
+    // True until the writing txn commits.
+    bool pending_;
+  };
+
+  struct Record {
+    Record();
+
+    // Versions of the record that an active txn may still read or write,
+    // ordered by 'wts_'.
+    deque<Version> versions_;
+
+    // Timestamp of the latest txn that read any version (T/O only).
+    uint64 rts_;
+  };
+
+  // Returns the index in 'versions' of the newest version written before
+  // 'ts', or -1 if every version that is kept was written at or after 'ts'
+  // (so the one the txn should see has been discarded).
+  static int Before(const deque<Version>& versions, uint64 ts);
+
+  // Returns the index in 'versions' of the newest committed version.
+  static int Newest(const deque<Version>& versions);
+
+  // Returns the index in 'versions' of the version written at 'ts'.
+  static int At(const deque<Version>& versions, uint64 ts);
+
+  bool multiversion_;
+
+  unordered_map<Key, Record> data_;
+
+  // Guards 'data_'. Signaled whenever a pending version commits or aborts.
+  pthread_mutex_t mutex_;
+  pthread_cond_t resolved_;
 };
 
 #endif  // _STORAGE_H_
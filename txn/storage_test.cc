@@ -0,0 +1,72 @@
+#include "txn/storage.h"
+
+#include <pthread.h>
+
+#include "utils/testing.h"
+
+// Applies 1000 increments of key 1 to the Storage passed as 'arg'.
+void* AddThousand(void* arg) {
+  Storage* storage = reinterpret_cast<Storage*>(arg);
+  for (int i = 0; i < 1000; i++)
+    storage->Apply(1, Delta(ADD, 1));
+  return NULL;
+}
+
+TEST(Storage_Apply) {
+  Storage storage;
+  Value value;
+
+  // Missing records start out as the update's argument.
+  storage.Apply(1, Delta(ADD, 5));
+  storage.Apply(2, Delta(MIN, 7));
+  storage.Apply(2, Delta(MIN, 9));
+  storage.Apply(3, Delta(MAX, 7));
+  storage.Apply(3, Delta(MAX, 9));
+  EXPECT_TRUE(storage.Read(1, &value));
+  EXPECT_EQ(5, value);
+  EXPECT_TRUE(storage.Read(2, &value));
+  EXPECT_EQ(7, value);
+  EXPECT_TRUE(storage.Read(3, &value));
+  EXPECT_EQ(9, value);
+
+  END;
+}
+
+TEST(Storage_SplitHotKeys) {
+  Storage storage;
+  storage.EnableSplitting();
+  storage.Write(1, 0);
+  double written = storage.Timestamp(1);
+  EXPECT_FALSE(storage.Split(1));
+
+  // Concurrent increments split the record, and none of them is lost.
+  pthread_t threads[4];
+  for (int i = 0; i < 4; i++)
+    pthread_create(&threads[i], NULL, AddThousand, &storage);
+  for (int i = 0; i < 4; i++)
+    pthread_join(threads[i], NULL);
+  EXPECT_TRUE(storage.Split(1));
+
+  // Updates applied to slices still count as updates of the record, and
+  // checking its timestamp joins it.
+  EXPECT_TRUE(storage.Timestamp(1) > written);
+  EXPECT_FALSE(storage.Split(1));
+
+  Value value;
+  EXPECT_TRUE(storage.Read(1, &value));
+  EXPECT_EQ(4000, value);
+
+  // Once joined, the record can be split again, and reading it joins it.
+  AddThousand(&storage);
+  EXPECT_TRUE(storage.Split(1));
+  EXPECT_TRUE(storage.Read(1, &value));
+  EXPECT_EQ(5000, value);
+  EXPECT_FALSE(storage.Split(1));
+
+  END;
+}
+
+int main(int argc, char** argv) {
+  Storage_Apply();
+  Storage_SplitHotKeys();
+}
@@ -2,19 +2,65 @@
 
 #include "txn/txn.h"
 
+Txn::Txn()
+    : status_(INCOMPLETE), hook_(NULL), doomed_(false), restarts_(0),
+      wasted_time_(0), request_time_(0), latency_(0) {
+  readset_.UseArena(&arena_);
+  writeset_.UseArena(&arena_);
+  blindset_.UseArena(&arena_);
+  deltaset_.UseArena(&arena_);
+  reads_.UseArena(&arena_);
+  writes_.UseArena(&arena_);
+  deltas_.UseArena(&arena_);
+}
+
+void Txn::Recycle() {
+  // Nothing may point into the arena once it is reset.
+  readset_.Reset();
+  writeset_.Reset();
+  blindset_.Reset();
+  deltaset_.Reset();
+  reads_.Reset();
+  writes_.Reset();
+  deltas_.Reset();
+  arena_.Reset();
+
+  status_ = INCOMPLETE;
+  hook_ = NULL;
+  doomed_ = false;
+  ssi_.reset();
+  restarts_ = 0;
+  wasted_time_ = 0;
+  request_time_ = 0;
+  latency_ = 0;
+  on_done_ = InlineTask();
+  locks_.clear();
+}
+
 bool Txn::Read(const Key& key, Value* value) {
   // Check that key is in readset/writeset.
   if (readset_.count(key) == 0 && writeset_.count(key) == 0)
     DIE("Invalid read (key not in readset or writeset).");
 
-  // Reads have no effect if we have already aborted or committed.
-  if (status_ != INCOMPLETE)
+  // Write-only keys may only be read back after the txn has written them.
+  if (blindset_.count(key) && writes_.count(key) == 0)
+    DIE("Invalid read of write-only key " << key << " (blindset).");
+
+  // Reads have no effect if we have already aborted or committed, or have
+  // been doomed.
+  if (status_ != INCOMPLETE || doomed_)
     return false;
 
-  // 'reads_' has already been populated by TxnProcessor, so it should contain
-  // the target value iff the record appears in the database.
-  if (reads_.count(key)) {
-    *value = reads_[key];
+  // Records are read on demand through 'hook_' the first time the txn reads
+  // them, unless the TxnProcessor has already populated 'reads_' (e.g. on
+  // the read-only fast path), in which case it contains the target value iff
+  // the record appears in the database.
+  ValueMap::iterator it = reads_.find(key);
+  if (it != reads_.end()) {
+    *value = it->second;
+    return true;
+  } else if (hook_ != NULL && hook_->OnRead(this, key, value)) {
+    reads_[key] = *value;
     return true;
   } else {
     return false;
@@ -26,33 +72,116 @@ void Txn::Write(const Key& key, const Value& value) {
   if (writeset_.count(key) == 0)
     DIE("Invalid write to key " << key << " (writeset).");
 
-  // Writes have no effect if we have already aborted or committed.
-  if (status_ != INCOMPLETE)
+  // Writes have no effect if we have already aborted or committed, or have
+  // been doomed.
+  if (status_ != INCOMPLETE || doomed_)
     return;
 
   // Set key-value pair in write buffer.
-  writes_[key] = value;
+  ValueMap::iterator it = writes_.find(key);
+  if (it != writes_.end()) {
+    it->second = value;
+  } else {
+    if (hook_ != NULL) {
+      hook_->OnWrite(this, key);
+      if (doomed_)
+        return;
+    }
+    writes_[key] = value;
+  }
 
   // Also set key-value pair in read results in case txn logic requires the
   // record to be re-read.
   reads_[key] = value;
 }
 
+void Txn::Update(const Key& key, DeltaOp op, Value arg) {
+  // Check that key is in deltaset.
+  if (deltaset_.count(key) == 0)
+    DIE("Invalid update of key " << key << " (deltaset).");
+
+  // Updates have no effect if we have already aborted or committed, or have
+  // been doomed.
+  if (status_ != INCOMPLETE || doomed_)
+    return;
+
+  DeltaMap::iterator it = deltas_.find(key);
+  if (it == deltas_.end()) {
+    deltas_.insert(std::make_pair(key, Delta(op, arg)));
+  } else if (it->second.op_ == op) {
+    it->second.arg_ = ApplyDelta(op, true, it->second.arg_, arg);
+  } else {
+    DIE("Mixed commutative operations on key " << key << ".");
+  }
+}
+
+void Txn::Retire(const Key& key) {
+  // Check that key has been written.
+  if (writeset_.count(key) == 0)
+    DIE("Invalid retire of key " << key << " (writeset).");
+
+  // Retiring has no effect if we have already aborted or committed, or have
+  // been doomed.
+  if (status_ != INCOMPLETE || doomed_)
+    return;
+
+  if (writes_.count(key) == 0)
+    DIE("Retire of key " << key << " before writing it.");
+
+  if (hook_ != NULL)
+    hook_->OnRetire(this, key);
+}
+
+// Longest time, in seconds, that 'Work()' sleeps without checking whether the
+// txn has been doomed.
+#define WORK_SLICE 0.001
+
+void Txn::Work(double duration) {
+  double end = GetTime() + duration;
+  while (!doomed_) {
+    double left = end - GetTime();
+    if (left <= 0)
+      break;
+    Sleep(left < WORK_SLICE ? left : WORK_SLICE);
+  }
+}
+
 void Txn::CheckReadWriteSets() {
-  for (set<Key>::iterator it = writeset_.begin();
-       it != writeset_.end(); ++it) {
-    if (readset_.count(*it) > 0) {
-      DIE("Overlapping read/write sets\n.");
+  // Keys in both the read and the write set are read-modify-writes, which
+  // every mode supports.
+  for (KeySet::iterator it = deltaset_.begin();
+       it != deltaset_.end(); ++it) {
+    if (readset_.count(*it) > 0 || writeset_.count(*it) > 0) {
+      DIE("Key " << *it << " in deltaset and readset or writeset.");
+    }
+  }
+  for (KeySet::iterator it = blindset_.begin();
+       it != blindset_.end(); ++it) {
+    if (writeset_.count(*it) == 0) {
+      DIE("Write-only key " << *it << " not in writeset (blindset).");
     }
   }
 }
 
 void Txn::CopyTxnInternals(Txn* txn) const {
-  txn->readset_ = set<Key>(this->readset_);
-  txn->writeset_ = set<Key>(this->writeset_);
-  txn->reads_ = map<Key, Value>(this->reads_);
-  txn->writes_ = map<Key, Value>(this->writes_);
+  txn->readset_ = this->readset_;
+  txn->writeset_ = this->writeset_;
+  txn->blindset_ = this->blindset_;
+  txn->deltaset_ = this->deltaset_;
+  txn->reads_ = this->reads_;
+  txn->writes_ = this->writes_;
+  txn->deltas_ = this->deltas_;
   txn->status_ = this->status_;
   txn->unique_id_ = this->unique_id_;
   txn->occ_start_time_ = this->occ_start_time_;
+  txn->lock_request_time_ = this->lock_request_time_;
+  txn->start_ts_ = this->start_ts_;
+  txn->hook_ = this->hook_;
+  txn->doomed_ = this->doomed_.load();
+  txn->ssi_ = this->ssi_;
+  txn->restarts_ = this->restarts_;
+  txn->wasted_time_ = this->wasted_time_;
+  txn->request_time_ = this->request_time_;
+  txn->latency_ = this->latency_;
+  txn->locks_ = vector<Key>(this->locks_);
 }
@@ -3,14 +3,21 @@
 #ifndef _TXN_H_
 #define _TXN_H_
 
+#include <algorithm>
+#include <atomic>
 #include <map>
+#include <memory>
 #include <set>
 #include <vector>
 
+#include "txn/active_set.h"
 #include "txn/common.h"
+#include "utils/flat_set.h"
+#include "utils/task.h"
 
 using std::map;
 using std::set;
+using std::shared_ptr;
 using std::vector;
 
 // Txns can have five distinct status values:
@@ -22,23 +29,140 @@ enum TxnStatus {
   ABORTED = 4,      // Aborted
 };
 
+// Conflict bookkeeping for Serializable Snapshot Isolation. A txn's SSIInfo is
+// shared with the TxnProcessor's conflict tables, so it stays alive after the
+// txn itself is returned to the client for as long as a concurrent txn may
+// still form an rw-antidependency with it.
+struct SSIInfo {
+  explicit SSIInfo(uint64 start_ts)
+      : start_ts_(start_ts), commit_ts_(0), aborted_(false),
+        in_conflict_(false), out_conflict_(false) {}
+
+  // Snapshot and commit timestamps (commit_ts_ is 0 until committed).
+  uint64 start_ts_;
+  uint64 commit_ts_;
+
+  // Set if the attempt this record describes did not commit.
+  bool aborted_;
+
+  // Whether some concurrent txn has an rw-antidependency to (in) or from
+  // (out) this one. A txn with both is the pivot of a dangerous structure.
+  bool in_conflict_;
+  bool out_conflict_;
+};
+
+// Commutative operations that a txn can apply to a record without reading it
+// (see 'Txn::Add()', 'Txn::Min()' and 'Txn::Max()').
+enum DeltaOp {
+  ADD = 0,
+  MIN = 1,
+  MAX = 2,
+};
+
+// A txn's pending commutative update of one record.
+struct Delta {
+  Delta() : op_(ADD), arg_(0) {}
+  Delta(DeltaOp op, Value arg) : op_(op), arg_(arg) {}
+  DeltaOp op_;
+  Value arg_;
+};
+
+// Returns the result of applying 'op' with argument 'arg' to a record whose
+// value is 'value'. A missing record takes the value 'arg' (i.e. it counts as
+// 0 for ADD).
+static inline Value ApplyDelta(DeltaOp op, bool exists, Value value,
+                               Value arg) {
+  if (!exists)
+    return arg;
+  switch (op) {
+    case ADD: return value + arg;
+    case MIN: return std::min(value, arg);
+    case MAX: return std::max(value, arg);
+  }
+  return value;
+}
+
+// Sets of keys, and maps from keys to a txn's reads, writes and commutative
+// updates. They are stored flat (see utils/flat_set.h), and are large enough
+// that a txn of typical size never allocates for them.
+typedef FlatSet<Key, 16> KeySet;
+typedef FlatMap<Key, Value, 16> ValueMap;
+typedef FlatMap<Key, Delta, 4> DeltaMap;
+
+class Txn;
+
+// Interface through which a concurrency control scheme sees each of a txn's
+// reads and writes while its logic runs, instead of only before and after
+// (e.g. timestamp ordering, which checks every access against per-record
+// timestamps as it happens).
+class AccessHook {
+ public:
+  virtual ~AccessHook() {}
+
+  // Called by 'Txn::Read()' for a key that the txn has neither read nor
+  // written yet. If the record exists, sets '*value' equal to its value and
+  // returns true, else returns false. May doom 'txn' instead.
+  virtual bool OnRead(Txn* txn, const Key& key, Value* value) = 0;
+
+  // Called by 'Txn::Write()' the first time the txn writes 'key'. May doom
+  // 'txn', in which case the write has no effect.
+  virtual void OnWrite(Txn* txn, const Key& key) = 0;
+
+  // Called by 'Txn::Retire()' once the txn has written 'key' for the last
+  // time.
+  virtual void OnRetire(Txn* txn, const Key& key) {}
+};
+
 class Txn {
  public:
   // Commit vote defauls to false. Only by calling "commit"
-  Txn() : status_(INCOMPLETE) {}
+  Txn();
   virtual ~Txn() {}
   virtual Txn * clone() const = 0;    // Virtual constructor (copying)
 
   // Method containing all the transaction's method logic.
   virtual void Run() = 0;
 
+  // Redoes only the part of 'Run()' that depends on the records in 'stale',
+  // whose new values have already replaced the old ones in 'reads_'. The
+  // txn's writes and commit vote otherwise stand. Returns false, without
+  // changing anything, if the txn cannot tell which part that is or if its
+  // vote might change; 'Run()' is then executed all over again.
+  //
+  // Note: Called on the TxnProcessor's scheduler thread, so it should be
+  //       quick.
+  virtual bool Repair(const KeySet& stale) { return false; }
+
   // Returns the Txn's current execution status.
   TxnStatus Status() { return status_; }
 
-  // Checks for overlap in read and write sets. If any key appears in both,
-  // an error occurs.
+  // Returns true if the Txn never writes (i.e. its writeset and deltaset are
+  // empty).
+  bool ReadOnly() const { return writeset_.empty() && deltaset_.empty(); }
+
+  // Returns the number of times the Txn was restarted by concurrency control
+  // before it committed or aborted.
+  int Restarts() const { return restarts_; }
+
+  // Returns the total time, in seconds, spent executing attempts of this Txn
+  // that were later restarted.
+  double WastedTime() const { return wasted_time_; }
+
+  // Returns the time, in seconds, from when the Txn was first requested until
+  // it committed or aborted.
+  double Latency() const { return latency_; }
+
+  // Checks that the delta set overlaps neither the read nor the write set,
+  // and that every write-only key is in the writeset. Otherwise an error
+  // occurs.
   void CheckReadWriteSets();
 
+  // Returns a Txn that its client has finished with to the state of a newly
+  // constructed one, with empty key sets, so that it can be set up and
+  // submitted again as a new request. Its memory is reused: the arena keeps
+  // the largest block it had, and subclass members are left as they are.
+  void Recycle();
+
  protected:
   // Copies the internals of this txn into a given transaction (i.e.
   // the readset, writeset, and so forth).  Be sure to modify this method
@@ -46,12 +170,14 @@ class Txn {
   void CopyTxnInternals(Txn* txn) const;
 
   friend class TxnProcessor;
+  friend class Invalidator;
 
   // Method to be used inside 'Execute()' function when reading records from
   // the database. If record corresponding with specified 'key' exists, sets
   // '*value' equal to the record value and returns true, else returns false.
   //
-  // Requires: key appears in readset or writeset
+  // Requires: key appears in readset or writeset, and if it is write-only
+  //           (blindset), has already been written
   //
   // Note: Can ONLY be called from inside the 'Execute()' function.
   bool Read(const Key& key, Value* value);
@@ -64,6 +190,37 @@ class Txn {
   // Note: Can ONLY be called from inside the 'Execute()' function.
   void Write(const Key& key, const Value& value);
 
+  // Methods to be used inside 'Execute()' function to add 'arg' to a record,
+  // or lower/raise it to 'arg', without reading it. Updates of the same kind
+  // commute, so concurrency control lets concurrent txns apply them to the
+  // same record without conflicting, and merges them when the txns commit.
+  // A txn may apply several updates of one kind to a key; they are combined.
+  //
+  // Requires: key appears in deltaset, and every txn updates it with the same
+  //           kind of operation
+  //
+  // Note: Can ONLY be called from inside the 'Execute()' function.
+  void Add(const Key& key, Value arg) { Update(key, ADD, arg); }
+  void Min(const Key& key, Value arg) { Update(key, MIN, arg); }
+  void Max(const Key& key, Value arg) { Update(key, MAX, arg); }
+
+  // Method to be used inside 'Execute()' function after the txn's last write
+  // to 'key'. Modes with early lock release (BAMBOO) may then hand the
+  // uncommitted value to other txns right away; other modes ignore it.
+  //
+  // Requires: key has been written, and is not written again afterwards
+  //
+  // Note: Can ONLY be called from inside the 'Execute()' function.
+  void Retire(const Key& key);
+
+  // Method to be used inside 'Execute()' function to simulate 'duration'
+  // seconds of work. Returns as soon as concurrency control dooms this
+  // attempt (possibly from another thread), since its results would be thrown
+  // away.
+  //
+  // Note: Can ONLY be called from inside the 'Execute()' function.
+  void Work(double duration);
+
   // Macro to be used inside 'Execute()' function when deciding to COMMIT.
   //
   // Note: Can ONLY be called from inside the 'Execute()' function.
@@ -82,18 +239,34 @@ class Txn {
       return; \
     } while (0)
 
+  // Backs all storage of the key sets and buffers below beyond what they
+  // hold inline, so that it is released in one step.
+  Arena arena_;
+
   // Set of all keys that may need to be read in order to execute the
   // transaction.
-  set<Key> readset_;
+  KeySet readset_;
 
   // Set of all keys that may be updated when executing the transaction.
-  set<Key> writeset_;
+  KeySet writeset_;
+
+  // Subset of 'writeset_' that the transaction writes without reading first
+  // (blind writes). These keys are never read from storage, and optimistic
+  // modes need not validate them.
+  KeySet blindset_;
+
+  // Set of all keys that may be updated with commutative operations only.
+  // These keys can be neither read nor written directly.
+  KeySet deltaset_;
 
   // Results of reads performed by the transaction.
-  map<Key, Value> reads_;
+  ValueMap reads_;
 
   // Key, Value pairs WRITTEN by the transaction.
-  map<Key, Value> writes_;
+  ValueMap writes_;
+
+  // Commutative updates performed by the transaction, combined per key.
+  DeltaMap deltas_;
 
   // Transaction's current execution status.
   TxnStatus status_;
@@ -105,6 +278,52 @@ class Txn {
 
   // Start time (used for OCC and MVCC).
   double occ_start_time_;
+
+  // Time at which the txn requested its locks (used for contention
+  // statistics in locking modes).
+  double lock_request_time_;
+
+  // Logical timestamp of the snapshot this txn reads (SI and SSI, and
+  // read-only txns on the fast path), or of the txn itself (T/O and MVTO).
+  uint64 start_ts_;
+
+  // If set, consulted on reads that 'reads_' cannot serve and on first
+  // writes to each key while the txn runs. This is how records are read on
+  // demand.
+  AccessHook* hook_;
+
+  // Set once concurrency control has decided that the current attempt must be
+  // restarted. Further reads and writes have no effect, and the TxnProcessor
+  // restarts the txn whatever its commit/abort vote.
+  std::atomic<bool> doomed_;
+
+  // Conflict bookkeeping for the current attempt (SSI only).
+  shared_ptr<SSIInfo> ssi_;
+
+  // Txns that were already validating when this one started to (OCC-P only).
+  // Released as soon as validation is done.
+  ActiveSet::Snapshot active_;
+
+  // Number of times this txn has been restarted, and the execution time
+  // those attempts wasted.
+  int restarts_;
+  double wasted_time_;
+
+  // Time at which the txn was first requested, and how long it took from
+  // then to commit or abort.
+  double request_time_;
+  double latency_;
+
+  // If set, run instead of queueing the txn for 'GetTxnResult()' once it has
+  // committed or aborted (see 'TxnProcessor::NewTxnRequest()').
+  InlineTask on_done_;
+
+  // Buffers a commutative update of 'key' (see 'Add()').
+  void Update(const Key& key, DeltaOp op, Value arg);
+
+  // Keys on which this txn requested locks (MOCC only). This is the subset
+  // of its readset/writeset that was hot when the txn was scheduled.
+  vector<Key> locks_;
 };
 
 #endif  // _TXN_H_
@@ -9,64 +9,558 @@
 
 #include "txn/lock_manager.h"
 
-// Thread & queue counts for StaticThreadPool initialization.
+// Default thread count for StaticThreadPool initialization. Simulated txns
+// spend most of their time sleeping in 'Txn::Work()', so this is far more than
+// the number of cores.
 #define THREAD_COUNT 100
-#define QUEUE_COUNT 10
 
-TxnProcessor::TxnProcessor(CCMode mode)
-    : mode_(mode), tp_(THREAD_COUNT, QUEUE_COUNT), next_unique_id_(1) {
+// Returns the CPUs to pin workers to: none unless 'options' includes
+// PIN_THREADS, and otherwise every core but the scheduler's (see
+// 'SchedulerCpu()'), if there are any others.
+static vector<int> WorkerCpus(int options) {
+  vector<int> cpus;
+  if (!(options & PIN_THREADS))
+    return cpus;
+  CpuTopology topology;
+  vector<int> all = topology.Cpus();
+  for (uint32 i = 0; i < all.size(); i++) {
+    if (!topology.SameCore(all[i], all[0]))
+      cpus.push_back(all[i]);
+  }
+  return cpus.empty() ? all : cpus;
+}
+
+// Returns the CPU to pin the scheduler thread to, or -1 unless 'options'
+// includes PIN_THREADS.
+static int SchedulerCpu(int options) {
+  if (!(options & PIN_THREADS))
+    return -1;
+  return CpuTopology().Cpus()[0];
+}
+
+TxnProcessor::TxnProcessor(CCMode mode, int options, int threads)
+    : mode_(mode), options_(options),
+      tp_(threads > 0 ? threads : THREAD_COUNT, WorkerCpus(options)),
+      scheduler_cpu_(SchedulerCpu(options)), next_unique_id_(1),
+      completed_txns_(tp_.ThreadCount()), next_ticket_(0),
+      validated_txns_(tp_.ThreadCount()), sessions_(NULL),
+      next_session_(NULL),
+      lm_(NULL), hot_keys_(0), last_cooldown_(GetTime()),
+      in_flight_(0), draining_(false), last_commit_ts_(0),
+      last_prune_(GetTime()), to_storage_(mode == MVTO), next_ts_(1),
+      retired_(tp_.ThreadCount()), on_demand_(this), snapshot_reads_(this) {
+  // The scheduler (and invalidator) each keep a thread busy for good.
+  int background = (options_ & EARLY_ABORT) ? 2 : 1;
+  if (tp_.ThreadCount() <= background)
+    DIE("TxnProcessor needs more than " << background << " threads.");
+
   if (mode_ == LOCKING_EXCLUSIVE_ONLY)
     lm_ = new LockManagerA(&ready_txns_);
-  else if (mode_ == LOCKING)
+  else if (mode_ == LOCKING || mode_ == MOCC || mode_ == ADAPTIVE ||
+           mode_ == BAMBOO)
     lm_ = new LockManagerB(&ready_txns_);
 
+  if (options_ & SPLIT_HOT_KEYS)
+    storage_.EnableSplitting();
+
   // Start 'RunScheduler()' running as a new task in its own thread.
   tp_.RunTask(
         new Method<TxnProcessor, void>(this, &TxnProcessor::RunScheduler));
+
+  // Likewise for 'RunInvalidator()'.
+  if (options_ & EARLY_ABORT) {
+    tp_.RunTask(
+          new Method<TxnProcessor, void>(this, &TxnProcessor::RunInvalidator));
+  }
 }
 
 TxnProcessor::~TxnProcessor() {
-  if (mode_ == LOCKING_EXCLUSIVE_ONLY || mode_ == LOCKING)
-    delete lm_;
+  // The scheduler loop and any running txns use the queues below, which are
+  // destroyed before 'tp_' is.
+  tp_.Stop();
+  delete lm_;
+
+  TxnSession* session = sessions_.load(std::memory_order_relaxed);
+  while (session != NULL) {
+    TxnSession* next = session->next_;
+    delete session;
+    session = next;
+  }
 }
 
 void TxnProcessor::NewTxnRequest(Txn* txn) {
-  // Atomically assign the txn a new number and add it to the incoming txn
-  // requests queue.
+  NewTxnRequests(&txn, 1);
+}
+
+void TxnProcessor::NewTxnRequests(Txn** txns, int n) {
+  // Reject malformed key sets before taking the lock.
+  for (int i = 0; i < n; i++) {
+    if (txns[i]->restarts_ == 0)
+      txns[i]->CheckReadWriteSets();
+  }
+
+  // Atomically assign the txns consecutive numbers and add them to the
+  // incoming txn requests queue.
+  double now = GetTime();
   mutex_.Lock();
-  txn->unique_id_ = next_unique_id_;
-  next_unique_id_++;
-  txn_requests_.Push(txn);
+  uint64 id = next_unique_id_.fetch_add(n);
+  for (int i = 0; i < n; i++) {
+    if (txns[i]->restarts_ == 0)
+      txns[i]->request_time_ = now;
+    txns[i]->unique_id_ = id + i;
+  }
+  txn_requests_.PushBatch(txns, n);
   mutex_.Unlock();
+  wakeup_.Notify();
+}
+
+TxnSession* TxnProcessor::NewSession() {
+  TxnSession* session = new TxnSession(this);
+  session->next_ = sessions_.load(std::memory_order_relaxed);
+  while (!sessions_.compare_exchange_weak(session->next_, session)) {}
+  return session;
+}
+
+void TxnProcessor::NewSessionRequests(TxnSession* session, Txn** txns,
+                                      int n) {
+  // Ids still come from the shared counter, but the session's own queue
+  // needs no lock to keep them in order. (They may then reach the scheduler
+  // out of order across sessions, which is why T/O timestamps are given out
+  // on admission instead.)
+  double now = GetTime();
+  uint64 id = next_unique_id_.fetch_add(n);
+  for (int i = 0; i < n; i++) {
+    if (txns[i]->restarts_ == 0) {
+      txns[i]->CheckReadWriteSets();
+      txns[i]->request_time_ = now;
+    }
+    txns[i]->unique_id_ = id + i;
+    txns[i]->on_done_ = InlineTask(session, &TxnSession::Deliver, txns[i]);
+  }
+  session->requests_.PushBatch(txns, n);
+  wakeup_.Notify();
+}
+
+bool TxnProcessor::NextSessionRequest(Txn** txn) {
+  TxnSession* newest = sessions_.load(std::memory_order_acquire);
+  if (newest == NULL)
+    return false;
+  TxnSession* first = next_session_ != NULL ? next_session_ : newest;
+  TxnSession* session = first;
+  do {
+    TxnSession* next = session->next_;
+    if (session->requests_.Pop(txn)) {
+      next_session_ = next;
+      return true;
+    }
+    session = next != NULL ? next : newest;
+  } while (session != first);
+  return false;
+}
+
+void TxnProcessor::NewTxnRequest(Txn* txn, const InlineTask& on_done) {
+  txn->on_done_ = on_done;
+  NewTxnRequest(txn);
+}
+
+void TxnProcessor::NewTxnRequest(Txn* txn, TxnFuture* future) {
+  future->txn_ = txn;
+  future->ready_.store(false, std::memory_order_relaxed);
+  future->event_ = &futures_ready_;
+  NewTxnRequest(txn, InlineTask(this, &TxnProcessor::CompleteFuture, future));
+}
+
+// Pops up to 'max' txns from '*results' into 'txns', waiting up to 'timeout'
+// seconds (forever if negative) on '*ready' for there to be any. Returns the
+// number popped.
+static int PopResults(AtomicQueue<Txn*>* results, EventCount* ready,
+                      Txn** txns, int max, double timeout) {
+  double deadline = GetTime() + timeout;
+  int n;
+  while ((n = results->PopBatch(txns, max)) == 0) {
+    // No result yet. Look once more after registering as a waiter, so that a
+    // result queued in between is not missed, then sleep until one is.
+    uint32 key = ready->PrepareWait();
+    if ((n = results->PopBatch(txns, max)) > 0) {
+      ready->CancelWait();
+      return n;
+    }
+    double left = deadline - GetTime();
+    if (timeout >= 0 && left <= 0) {
+      ready->CancelWait();
+      return 0;
+    }
+    ready->Wait(key, timeout >= 0 ? left : -1);
+  }
+  return n;
 }
 
 Txn* TxnProcessor::GetTxnResult() {
   Txn* txn;
-  while (!txn_results_.Pop(&txn)) {
-    // No result yet. Wait a bit before trying again (to reduce contention on
-    // atomic queues).
-    sleep(0.000001);
-  }
+  GetTxnResult(&txn, -1);
+  return txn;
+}
+
+bool TxnProcessor::GetTxnResult(Txn** txn, double timeout) {
+  return GetTxnResults(txn, 1, timeout) == 1;
+}
+
+int TxnProcessor::GetTxnResults(Txn** txns, int max, double timeout) {
+  return PopResults(&txn_results_, &results_ready_, txns, max, timeout);
+}
+
+void TxnProcessor::CompleteFuture(TxnFuture* future) {
+  // The client may destroy '*future' as soon as it sees it ready, so this is
+  // the last access to it.
+  future->ready_.store(true, std::memory_order_release);
+  futures_ready_.NotifyAll();
+}
+
+void TxnSession::NewTxnRequest(Txn* txn) {
+  processor_->NewSessionRequests(this, &txn, 1);
+}
+
+void TxnSession::NewTxnRequests(Txn** txns, int n) {
+  processor_->NewSessionRequests(this, txns, n);
+}
+
+Txn* TxnSession::GetTxnResult() {
+  Txn* txn;
+  GetTxnResult(&txn, -1);
   return txn;
 }
 
+bool TxnSession::GetTxnResult(Txn** txn, double timeout) {
+  return GetTxnResults(txn, 1, timeout) == 1;
+}
+
+int TxnSession::GetTxnResults(Txn** txns, int max, double timeout) {
+  return PopResults(&results_, &results_ready_, txns, max, timeout);
+}
+
+void TxnSession::Deliver(Txn* txn) {
+  results_.Push(txn);
+  results_ready_.Notify();
+}
+
+bool TxnFuture::Ready() const {
+  return ready_.load(std::memory_order_acquire);
+}
+
+Txn* TxnFuture::Get(double timeout) {
+  // A future that no request was made with would never become ready.
+  if (event_ == NULL)
+    return NULL;
+
+  double deadline = GetTime() + timeout;
+  while (!Ready()) {
+    uint32 key = event_->PrepareWait();
+    if (Ready()) {
+      event_->CancelWait();
+      break;
+    }
+    double left = deadline - GetTime();
+    if (timeout >= 0 && left <= 0) {
+      event_->CancelWait();
+      return NULL;
+    }
+    event_->Wait(key, timeout >= 0 ? left : -1);
+  }
+  return txn_;
+}
+
 void TxnProcessor::RunScheduler() {
+  // If the scheduler cannot be pinned (see 'PinThread()'), it runs unpinned.
+  if (scheduler_cpu_ >= 0 && !PinThread(pthread_self(), scheduler_cpu_))
+    scheduler_cpu_ = -1;
+
   switch (mode_) {
-    case SERIAL:                 RunSerialScheduler();
-    case LOCKING:                RunLockingScheduler();
-    case LOCKING_EXCLUSIVE_ONLY: RunLockingScheduler();
-    case OCC:                    RunOCCScheduler();
-    case P_OCC:                  RunOCCParallelScheduler();
+    case SERIAL:                 RunSerialScheduler(); break;
+    case LOCKING:                RunLockingScheduler(); break;
+    case LOCKING_EXCLUSIVE_ONLY: RunLockingScheduler(); break;
+    case OCC:                    RunOCCScheduler(); break;
+    case P_OCC:                  RunOCCParallelScheduler(); break;
+    case MOCC:                   RunMOCCScheduler(); break;
+    case ADAPTIVE:               RunAdaptiveScheduler(); break;
+    case SI:                     RunSnapshotScheduler(); break;
+    case SSI:                    RunSnapshotScheduler(); break;
+    case TO:                     RunTimestampScheduler(); break;
+    case MVTO:                   RunTimestampScheduler(); break;
+    case BAMBOO:                 RunBambooScheduler(); break;
+  }
+}
+
+bool TxnProcessor::SchedulerActive() {
+  if (mode_ == ADAPTIVE && !draining_)
+    MonitorWindow();
+
+  // A draining scheduler hands over control once its last in-flight txn has
+  // been returned or sent back to the request queue.
+  if (!tp_.Active() || (draining_ && in_flight_ == 0))
+    return false;
+
+  WaitForWork();
+  return true;
+}
+
+bool TxnProcessor::SchedulerIdle() {
+  if (!draining_) {
+    for (TxnSession* session = sessions_.load(std::memory_order_acquire);
+         session != NULL; session = session->next_) {
+      if (session->requests_.Size() > 0)
+        return false;
+    }
+  }
+
+  // Everything else the schedulers keep to themselves (e.g. txns waiting for
+  // locks or for earlier validators) only changes when one of these does.
+  return (draining_ || txn_requests_.Size() == 0) &&
+         completed_txns_.Empty() && validated_txns_.Empty() &&
+         retired_.Empty() && ready_txns_.empty() && fallback_.empty() &&
+         retries_.empty();
+}
+
+// Longest time, in seconds, an idle scheduler sleeps before checking for
+// timed work (and whether the processor is shutting down) again.
+#define IDLE_TIMEOUT 0.001
+
+void TxnProcessor::WaitForWork() {
+  if (!SchedulerIdle())
+    return;
+
+  // Look once more after registering as a waiter, so that work handed over
+  // in between is not missed.
+  uint32 key = wakeup_.PrepareWait();
+  double timeout = IDLE_TIMEOUT;
+  if (!backoff_.empty())
+    timeout = std::min(timeout, backoff_.begin()->first - GetTime());
+  if (timeout <= 0 || !SchedulerIdle()) {
+    wakeup_.CancelWait();
+    return;
+  }
+  wakeup_.Wait(key, timeout);
+}
+
+bool TxnProcessor::Admit(Txn** txn) {
+  if (NextRetry(txn))
+    return true;
+  if (draining_ || (!txn_requests_.Pop(txn) && !NextSessionRequest(txn)))
+    return false;
+  in_flight_++;
+  return true;
+}
+
+void TxnProcessor::Finish(Txn* txn) {
+  in_flight_--;
+  stats_.finished++;
+  txn->latency_ = GetTime() - txn->request_time_;
+  if (txn->on_done_.Empty()) {
+    txn_results_.Push(txn);
+    results_ready_.Notify();
+    return;
+  }
+
+  // The callback hands the txn back to the client, who may reuse it at once.
+  InlineTask on_done = txn->on_done_;
+  txn->on_done_ = InlineTask();
+  on_done.Run();
+}
+
+// Number of times an OCC(-P) txn is retried from the retry queue before it
+// falls back to pessimistic execution.
+#define MAX_RETRIES 5
+
+// Backoff, in seconds, before the first retry from the retry queue. It doubles
+// with every further retry, up to MAX_BACKOFF. The actual backoff is drawn
+// uniformly from zero up to that limit.
+#define MIN_BACKOFF 0.0001
+#define MAX_BACKOFF 0.01
+
+void TxnProcessor::Restart(Txn* txn) {
+  stats_.restarted++;
+  txn->restarts_++;
+  txn->wasted_time_ += GetTime() - txn->occ_start_time_;
+  txn->status_ = INCOMPLETE;
+  txn->doomed_ = false;
+
+  CCMode mode = (mode_ == ADAPTIVE) ? active_mode_ : mode_;
+  if ((options_ & RETRY_QUEUE) && (mode == OCC || mode == P_OCC)) {
+    if (txn->restarts_ > MAX_RETRIES) {
+      fallback_.push_back(txn);
+    } else {
+      double limit = MIN_BACKOFF * (1 << (txn->restarts_ - 1));
+      if (limit > MAX_BACKOFF)
+        limit = MAX_BACKOFF;
+      backoff_.insert(std::make_pair(GetTime() + RandomDouble(limit), txn));
+    }
+    return;
+  }
+
+  in_flight_--;
+  NewTxnRequest(txn);
+}
+
+bool TxnProcessor::NextRetry(Txn** txn) {
+  double now = GetTime();
+  while (!backoff_.empty() && backoff_.begin()->first <= now) {
+    Txn* ready = backoff_.begin()->second;
+    retries_.insert(std::make_pair(ready->request_time_, ready));
+    backoff_.erase(backoff_.begin());
+  }
+
+  if (retries_.empty())
+    return false;
+  *txn = retries_.begin()->second;
+  retries_.erase(retries_.begin());
+  return true;
+}
+
+void TxnProcessor::RunFallback(Txn* txn) {
+  // Nothing can invalidate the txn while it runs, so it needs no validation.
+  ReadAndRun(txn);
+  if (txn->Status() == COMPLETED_C) {
+    ApplyWrites(txn);
+  } else if (txn->Status() == COMPLETED_A) {
+    txn->status_ = ABORTED;
+  } else {
+    // Invalid TxnStatus!
+    DIE("Completed Txn has invalid TxnStatus: " << txn->Status());
+  }
+  Finish(txn);
+}
+
+// Length, in seconds, of each ADAPTIVE monitoring window.
+#define WINDOW 0.05
+
+// Number of consecutive windows that must agree on a new mode before the
+// ADAPTIVE scheduler switches to it.
+#define HYSTERESIS 3
+
+// Minimum time, in seconds, spent in SERIAL mode before probing LOCKING again
+// (SERIAL execution gives no contention signal of its own).
+#define SERIAL_DWELL 1.0
+
+// Fraction of OCC(-P) attempts ending in a restart above which locking is
+// preferred, and below which OCC may hand validation to the worker threads.
+#define ABORT_HIGH 0.3
+#define ABORT_LOW 0.05
+
+// Fraction of a locked txn's lifetime spent waiting for locks below which OCC
+// is preferred, and above which execution is effectively serial anyway.
+#define CONTENTION_LOW 0.1
+#define CONTENTION_SERIAL 0.9
+
+// Fraction of the window the OCC scheduler thread spends validating above
+// which validation is moved to the worker threads (P_OCC).
+#define VALIDATION_BUSY 0.5
+
+// Relative throughput drop after moving to P_OCC that sends us back to OCC.
+#define P_OCC_REGRESSION 0.75
+
+void TxnProcessor::RunAdaptiveScheduler() {
+  active_mode_ = OCC;
+  mode_start_ = GetTime();
+  window_start_ = mode_start_;
+  candidate_ = OCC;
+  candidate_windows_ = 0;
+  occ_throughput_ = 0;
+
+  while (tp_.Active()) {
+    switch (active_mode_) {
+      case SERIAL:  RunSerialScheduler(); break;
+      case LOCKING: RunLockingScheduler(); break;
+      case OCC:     RunOCCScheduler(); break;
+      case P_OCC:   RunOCCParallelScheduler(); break;
+      default:      DIE("Invalid adaptive mode: " << active_mode_);
+    }
+
+    // The previous scheduler has quiesced: nothing is executing, locked or
+    // validating, so the next one can start from a clean slate.
+    active_mode_ = candidate_;
+    candidate_windows_ = 0;
+    mode_start_ = GetTime();
+    window_start_ = mode_start_;
+    stats_ = WindowStats();
+    draining_ = false;
+  }
+}
+
+void TxnProcessor::MonitorWindow() {
+  double now = GetTime();
+  if (now < window_start_ + WINDOW)
+    return;
+
+  CCMode choice = ChooseMode(stats_, now - window_start_);
+  if (choice == active_mode_) {
+    candidate_windows_ = 0;
+  } else if (choice == candidate_ && candidate_windows_ > 0) {
+    candidate_windows_++;
+  } else {
+    candidate_ = choice;
+    candidate_windows_ = 1;
+  }
+
+  if (candidate_windows_ >= HYSTERESIS) {
+    // Stop admitting new txns; the current scheduler returns once everything
+    // it admitted has completed.
+    if (active_mode_ == OCC)
+      occ_throughput_ = stats_.finished / (now - window_start_);
+    draining_ = true;
+  }
+
+  window_start_ = now;
+  stats_ = WindowStats();
+}
+
+CCMode TxnProcessor::ChooseMode(const WindowStats& stats, double window) {
+  int attempts = stats.finished + stats.restarted;
+  if (attempts == 0)
+    return active_mode_;
+  double abort_rate = static_cast<double>(stats.restarted) / attempts;
+
+  switch (active_mode_) {
+    case SERIAL:
+      if (GetTime() > mode_start_ + SERIAL_DWELL)
+        return LOCKING;
+      return SERIAL;
+
+    case LOCKING: {
+      double busy = stats.lock_wait_time + stats.execution_time;
+      double contention = busy > 0 ? stats.lock_wait_time / busy : 0;
+      if (contention > CONTENTION_SERIAL)
+        return SERIAL;
+      if (contention < CONTENTION_LOW)
+        return OCC;
+      return LOCKING;
+    }
+
+    case OCC:
+      if (abort_rate > ABORT_HIGH)
+        return LOCKING;
+      if (abort_rate < ABORT_LOW &&
+          stats.validation_time > VALIDATION_BUSY * window)
+        return P_OCC;
+      return OCC;
+
+    case P_OCC:
+      if (abort_rate > ABORT_HIGH)
+        return LOCKING;
+      if (stats.finished / window < P_OCC_REGRESSION * occ_throughput_)
+        return OCC;
+      return P_OCC;
+
+    default:
+      return active_mode_;
   }
 }
 
 void TxnProcessor::RunSerialScheduler() {
   Txn* txn;
-  while (tp_.Active()) {
+  while (SchedulerActive()) {
     // Get next txn request.
-    if (txn_requests_.Pop(&txn)) {
+    if (Admit(&txn)) {
       // Execute txn.
-      ExecuteTxn(txn);
+      ReadAndRun(txn);
 
       // Commit/abort txn according to program logic's commit/abort decision.
       if (txn->Status() == COMPLETED_C) {
@@ -80,49 +574,79 @@ void TxnProcessor::RunSerialScheduler() {
       }
 
       // Return result to client.
-      txn_results_.Push(txn);
+      Finish(txn);
     }
   }
 }
 
 void TxnProcessor::RunLockingScheduler() {
   Txn* txn;
-  while (tp_.Active()) {
+  while (SchedulerActive()) {
     // Start processing the next incoming transaction request.
-    if (txn_requests_.Pop(&txn)) {
-      int blocked = 0;
-      // Request read locks.
-      for (set<Key>::iterator it = txn->readset_.begin();
-           it != txn->readset_.end(); ++it) {
-        if (!lm_->ReadLock(txn, *it))
-          blocked++;
-      }
+    if (Admit(&txn)) {
+      if (txn->ReadOnly()) {
+        // Read-only txns never touch the lock table.
+        StartReadOnlyTxn(txn);
+      } else {
+        int blocked = 0;
+        // Request read locks. Keys that are also in the writeset only get a
+        // write lock, since a txn would otherwise queue behind its own shared
+        // lock.
+        for (KeySet::iterator it = txn->readset_.begin();
+             it != txn->readset_.end(); ++it) {
+          if (txn->writeset_.count(*it))
+            continue;
+          if (!lm_->ReadLock(txn, *it))
+            blocked++;
+        }
 
-      // Request write locks.
-      for (set<Key>::iterator it = txn->writeset_.begin();
-           it != txn->writeset_.end(); ++it) {
-        if (!lm_->WriteLock(txn, *it))
-          blocked++;
-      }
+        // Request write locks.
+        for (KeySet::iterator it = txn->writeset_.begin();
+             it != txn->writeset_.end(); ++it) {
+          if (!lm_->WriteLock(txn, *it))
+            blocked++;
+        }
+
+        // Request commutative locks, which other txns updating the same keys
+        // share.
+        for (KeySet::iterator it = txn->deltaset_.begin();
+             it != txn->deltaset_.end(); ++it) {
+          if (!lm_->CommuteLock(txn, *it))
+            blocked++;
+        }
 
-      // If all read and write locks were immediately acquired, this txn is
-      // ready to be executed.
-      if (blocked == 0)
-        ready_txns_.push_back(txn);
+        // If all read and write locks were immediately acquired, this txn is
+        // ready to be executed.
+        txn->lock_request_time_ = GetTime();
+        if (blocked == 0)
+          ready_txns_.push_back(txn);
+      }
     }
 
     // Process and commit all transactions that have finished running.
     while (completed_txns_.Pop(&txn)) {
+      if (txn->ReadOnly()) {
+        FinishReadOnlyTxn(txn);
+        continue;
+      }
+
+      stats_.execution_time += GetTime() - txn->occ_start_time_;
+
       // Release read locks.
-      for (set<Key>::iterator it = txn->readset_.begin();
+      for (KeySet::iterator it = txn->readset_.begin();
            it != txn->readset_.end(); ++it) {
         lm_->Release(txn, *it);
       }
       // Release write locks.
-      for (set<Key>::iterator it = txn->writeset_.begin();
+      for (KeySet::iterator it = txn->writeset_.begin();
            it != txn->writeset_.end(); ++it) {
         lm_->Release(txn, *it);
       }
+      // Release commutative locks.
+      for (KeySet::iterator it = txn->deltaset_.begin();
+           it != txn->deltaset_.end(); ++it) {
+        lm_->Release(txn, *it);
+      }
 
       // Commit/abort txn according to program logic's commit/abort decision.
       if (txn->Status() == COMPLETED_C) {
@@ -136,7 +660,7 @@ void TxnProcessor::RunLockingScheduler() {
       }
 
       // Return result to client.
-      txn_results_.Push(txn);
+      Finish(txn);
     }
 
     // Start executing all transactions that have newly acquired all their
@@ -145,59 +669,99 @@ void TxnProcessor::RunLockingScheduler() {
       // Get next ready txn from the queue.
       txn = ready_txns_.front();
       ready_txns_.pop_front();
+      txn->occ_start_time_ = GetTime();
+      stats_.lock_wait_time += txn->occ_start_time_ - txn->lock_request_time_;
 
       // Start txn running in its own thread.
-      tp_.RunTask(new Method<TxnProcessor, void, Txn*>(
-            this,
-            &TxnProcessor::ExecuteTxn,
-            txn));
+      tp_.RunTask(InlineTask(this, &TxnProcessor::ExecuteTxn, txn));
     }
   }
 }
 
 void TxnProcessor::RunOCCScheduler() {
   Txn* txn;
-  while (tp_.Active()) {
+  while (SchedulerActive()) {
+    // Writes are only applied by this thread, so txns that have run out of
+    // retries can run right here.
+    while (!fallback_.empty()) {
+      RunFallback(fallback_.front());
+      fallback_.pop_front();
+    }
+
     // Start processing the next incoming transaction request.
-    if (txn_requests_.Pop(&txn)) {
-      txn->occ_start_time_ = GetTime();
-      tp_.RunTask(new Method<TxnProcessor, void, Txn*>(
-            this,
-            &TxnProcessor::ExecuteTxn,
-            txn));
+    if (Admit(&txn)) {
+      if (txn->ReadOnly()) {
+        // Read-only txns are never validated.
+        StartReadOnlyTxn(txn);
+      } else {
+        txn->occ_start_time_ = GetTime();
+        if (options_ & EARLY_ABORT)
+          Watch(txn);
+        tp_.RunTask(InlineTask(this, &TxnProcessor::ExecuteTxn, txn));
+      }
     }
 
     // Verify all completed transactions
-    bool verified = true;
     while (completed_txns_.Pop(&txn)) {
+      if (txn->ReadOnly()) {
+        FinishReadOnlyTxn(txn);
+        continue;
+      }
+
+      if (options_ & EARLY_ABORT) {
+        Unwatch(txn);
+        if (txn->doomed_) {
+          // Validation would fail anyway. Try transaction again.
+          Restart(txn);
+          continue;
+        }
+      }
+
+      double validation_start = GetTime();
+      bool verified = true;
+      bool repair = options_ & REPAIR;
+      KeySet stale;
+
       // check for overlap in readset
-      for (set<Key>::iterator it = txn->readset_.begin();
+      for (KeySet::iterator it = txn->readset_.begin();
            it != txn->readset_.end(); ++it) {
         // if last modified > my start then invalid
         if (storage_.Timestamp(*it) > txn->occ_start_time_) {
           verified = false;
-          break;
+          if (!repair)
+            break;
+          stale.insert(*it);
         }
       }
 
-      // check for overlap in writeset
-      for (set<Key>::iterator it = txn->writeset_.begin();
+      // check for overlap in writeset (blind writes cannot go stale)
+      for (KeySet::iterator it = txn->writeset_.begin();
            it != txn->writeset_.end(); ++it) {
+        if (txn->blindset_.count(*it))
+          continue;
         // if last modified > my start then invalid
         if (storage_.Timestamp(*it) > txn->occ_start_time_) {
           verified = false;
-          break;
+          if (!repair)
+            break;
+          stale.insert(*it);
         }
       }
 
+      stats_.validation_time += GetTime() - validation_start;
+
       // Commit/abort txn according to program logic's commit/abort decision.
       if (txn->Status() == COMPLETED_C) {
         if (verified) {
           // Everything is hunky dory
           ApplyWrites(txn);
+        } else if (repair) {
+          // Fix up the txn instead of starting over.
+          if (!RepairTxn(txn, stale))
+            continue;
         } else {
           // Try transaction again
-          NewTxnRequest(txn);
+          Restart(txn);
           continue;
         }
       } else if (txn->Status() == COMPLETED_A) {
@@ -208,7 +772,7 @@ void TxnProcessor::RunOCCScheduler() {
       }
 
       // Return result to client.
-      txn_results_.Push(txn);
+      Finish(txn);
     }
   }
 }
@@ -222,129 +786,1142 @@ void TxnProcessor::RunOCCScheduler() {
 
 void TxnProcessor::RunOCCParallelScheduler() {
   Txn* txn;
-  while (tp_.Active()) {
+  while (SchedulerActive()) {
     // Start processing the next incoming transaction request.
-    if (txn_requests_.Pop(&txn)) {
+    if (Admit(&txn)) {
       txn->occ_start_time_ = GetTime();
-      tp_.RunTask(new Method<TxnProcessor, void, Txn*>(
-            this,
-            &TxnProcessor::ExecuteTxn,
-            txn));
+      if (options_ & EARLY_ABORT)
+        Watch(txn);
+      tp_.RunTask(InlineTask(this, &TxnProcessor::ExecuteTxn, txn));
     }
 
     // Restart or commit transactions
     std::pair<Txn*, bool> p;
     int j = 0;
     while (j++ < M && validated_txns_.Pop(&p)) {
-      active_set_.erase(p.first);
+      active_set_.Erase(p.first);
+      validating_.erase(tickets_[p.first]);
+      tickets_.erase(p.first);
       if (!p.second) {
-        p.first->status_ = INCOMPLETE;
-        NewTxnRequest(p.first);
+        Restart(p.first);
         continue;
       }
 
-      // Return result to client.
-      txn_results_.Push(p.first);
+      // Validators that started before now may still be reading the txn's
+      // read and write sets, so it can only be returned to the client once
+      // they have all finished.
+      validated_.push_back(std::make_pair(next_ticket_, p.first));
+    }
+
+    // Return results to client.
+    while (!validated_.empty() &&
+           (validating_.empty() ||
+            *validating_.begin() >= validated_.front().first)) {
+      Finish(validated_.front().second);
+      validated_.pop_front();
     }
 
-    // Set the verified state of completed transactions
+    // Once every validator has finished, txns that have run out of retries
+    // can run right here.
+    while (!fallback_.empty() && active_set_.Size() == 0) {
+      RunFallback(fallback_.front());
+      fallback_.pop_front();
+    }
+
+    // Set the verified state of completed transactions. No new validators are
+    // started while a txn is waiting to fall back.
     int i = 0;
-    while (i++ < N && completed_txns_.Pop(&txn)) {
-      set<Txn*> active_set_copy = set<Txn*>(active_set_);
-      active_set_.insert(txn);
-      tp_.RunTask(new Method<TxnProcessor, void, Txn*, set<Txn*>> (
-            this,
-            &TxnProcessor::ValidateTxn,
-            txn,
-            active_set_copy));
+    while (fallback_.empty() && i++ < N && completed_txns_.Pop(&txn)) {
+      if (options_ & EARLY_ABORT) {
+        Unwatch(txn);
+        if (txn->doomed_) {
+          // Validation would fail anyway. Try transaction again.
+          Restart(txn);
+          continue;
+        }
+      }
+
+      txn->active_ = active_set_.Insert(txn);
+      tickets_[txn] = next_ticket_;
+      validating_.insert(next_ticket_++);
+      tp_.RunTask(InlineTask(this, &TxnProcessor::ValidateTxn, txn));
     }
   }
 }
 
-void TxnProcessor::ValidateTxn(Txn *txn, set<Txn*> active_set_copy) {
-  // ensure that status is COMPLETED_C
-  if (txn->Status() == COMPLETED_A) {
-    txn->status_ = ABORTED;
-    validated_txns_.Push(std::make_pair(txn, true));
-    return;
-  } else if (txn->Status() != COMPLETED_C) {
-    DIE("Completed Txn has invalid TxnStatus: " << txn->Status());
-  }
+// A key is hot, and locked by MOCC, once txns that access it optimistically
+// fail validation on it at least HOT_RATIO times for every commit (both net
+// of decay). Retries run concurrently and usually cost less than queueing
+// behind a lock, so only keys that need many retries per commit are worth
+// locking.
+#define HOT_RATIO 16
 
-  bool verified = true;
+// Commits assumed on top of those counted, so that a key with few recent
+// commits (long txns, or a short decay window) is not locked on the strength
+// of a few unlucky aborts.
+#define HOT_PRIOR 4
 
-  // check for overlap in readset
-  for (set<Key>::iterator it = txn->readset_.begin();
-       it != txn->readset_.end(); ++it) {
-    // if last modified > my start then invalid
-    if (storage_.Timestamp(*it) > txn->occ_start_time_) {
-      verified = false;
-      break;
+// Interval, in seconds, at which MOCC halves all key temperatures.
+#define COOLDOWN_INTERVAL 0.05
+
+void TxnProcessor::RunMOCCScheduler() {
+  Txn* txn;
+  while (SchedulerActive()) {
+    // Start processing the next incoming transaction request. Only keys that
+    // are currently hot are locked; everything else is left to validation.
+    if (Admit(&txn)) {
+      if (txn->ReadOnly()) {
+        // Read-only txns are neither locked nor validated.
+        StartReadOnlyTxn(txn);
+      } else {
+        int blocked = 0;
+        txn->locks_.clear();
+
+        // Request read locks on hot keys that are not also being written.
+        for (KeySet::iterator it = txn->readset_.begin();
+             it != txn->readset_.end(); ++it) {
+          if (txn->writeset_.count(*it) || !IsHot(*it))
+            continue;
+          txn->locks_.push_back(*it);
+          if (!lm_->ReadLock(txn, *it))
+            blocked++;
+        }
+
+        // Request write locks on hot keys.
+        for (KeySet::iterator it = txn->writeset_.begin();
+             it != txn->writeset_.end(); ++it) {
+          if (!IsHot(*it))
+            continue;
+          txn->locks_.push_back(*it);
+          if (!lm_->WriteLock(txn, *it))
+            blocked++;
+        }
+
+        // Commutative updates of hot keys only conflict with readers and
+        // writers.
+        for (KeySet::iterator it = txn->deltaset_.begin();
+             it != txn->deltaset_.end(); ++it) {
+          if (!IsHot(*it))
+            continue;
+          txn->locks_.push_back(*it);
+          if (!lm_->CommuteLock(txn, *it))
+            blocked++;
+        }
+
+        // If all hot-key locks were immediately acquired (or none were needed),
+        // this txn is ready to be executed.
+        if (blocked == 0)
+          ready_txns_.push_back(txn);
+      }
     }
-  }
 
-  // check for overlap in writeset
-  for (set<Key>::iterator it = txn->writeset_.begin();
-       it != txn->writeset_.end(); ++it) {
-    // if last modified > my start then invalid
-    if (storage_.Timestamp(*it) > txn->occ_start_time_) {
-      verified = false;
-      break;
+    // Validate and commit/abort all transactions that have finished running.
+    while (completed_txns_.Pop(&txn)) {
+      if (txn->ReadOnly()) {
+        FinishReadOnlyTxn(txn);
+        continue;
+      }
+
+      bool restart = false;
+      if (txn->Status() == COMPLETED_C) {
+        // Locked keys are validated too, since a txn that scheduled before
+        // the key became hot may have written it optimistically. Every stale
+        // key is heated, not just the first one found.
+        bool verified = true;
+        for (KeySet::iterator it = txn->readset_.begin();
+             it != txn->readset_.end(); ++it) {
+          if (storage_.Timestamp(*it) > txn->occ_start_time_) {
+            HeatUp(*it);
+            verified = false;
+          }
+        }
+        for (KeySet::iterator it = txn->writeset_.begin();
+             it != txn->writeset_.end(); ++it) {
+          if (txn->blindset_.count(*it))
+            continue;
+          if (storage_.Timestamp(*it) > txn->occ_start_time_) {
+            HeatUp(*it);
+            verified = false;
+          }
+        }
+
+        if (verified) {
+          ApplyWrites(txn);
+          for (KeySet::iterator it = txn->readset_.begin();
+               it != txn->readset_.end(); ++it) {
+            CoolOff(*it);
+          }
+          for (KeySet::iterator it = txn->writeset_.begin();
+               it != txn->writeset_.end(); ++it) {
+            CoolOff(*it);
+          }
+        } else {
+          restart = true;
+        }
+      } else if (txn->Status() == COMPLETED_A) {
+        txn->status_ = ABORTED;
+      } else {
+        // Invalid TxnStatus!
+        DIE("Completed Txn has invalid TxnStatus: " << txn->Status());
+      }
+
+      // Release hot-key locks only after writes have been applied.
+      for (vector<Key>::iterator it = txn->locks_.begin();
+           it != txn->locks_.end(); ++it) {
+        lm_->Release(txn, *it);
+      }
+
+      if (restart) {
+        // Try transaction again, this time locking any keys that just
+        // became hot.
+        Restart(txn);
+      } else {
+        // Return result to client.
+        Finish(txn);
+      }
     }
-  }
 
-  // check if the writeset intersects with the read or write sets
-  // of any concurrently validating txns
-  for (set<Txn*>::iterator it = active_set_copy.begin();
-       it != active_set_copy.end(); ++it) {
-    for (set<Key>::iterator it2 = txn->writeset_.begin();
-        it2 != txn->writeset_.end(); ++it2) {
-      verified = verified && !(*it)->writeset_.count(*it2) &&
-                 !(*it)->readset_.count(*it2);
-      if (!verified) break;
+    CoolDown();
+
+    // Start executing all transactions that have newly acquired all their
+    // locks. The start time is taken here, after locks are held.
+    while (ready_txns_.size()) {
+      txn = ready_txns_.front();
+      ready_txns_.pop_front();
+
+      txn->occ_start_time_ = GetTime();
+      tp_.RunTask(InlineTask(this, &TxnProcessor::ExecuteTxn, txn));
     }
   }
+}
 
-  if (verified) ApplyWrites(txn);
-  validated_txns_.Push(std::make_pair(txn, verified));
+bool TxnProcessor::IsHot(const Key& key) {
+  // Most of the time no key is hot, and admission needs no lookups at all.
+  if (hot_keys_ == 0)
+    return false;
+  unordered_map<Key, Temperature>::iterator it = temperature_.find(key);
+  return it != temperature_.end() && it->second.hot;
 }
 
+void TxnProcessor::HeatUp(const Key& key) {
+  Temperature* temperature = &temperature_[key];
+  temperature->aborts++;
+  UpdateHot(temperature);
+}
 
-void TxnProcessor::ExecuteTxn(Txn* txn) {
-  // wipe reads_ and writes_
-  txn->reads_.clear();
-  txn->writes_.clear();
+void TxnProcessor::CoolOff(const Key& key) {
+  // Only keys that have failed validation recently are tracked, and commits
+  // under a lock say nothing about how the key would fare optimistically.
+  unordered_map<Key, Temperature>::iterator it = temperature_.find(key);
+  if (it != temperature_.end() && !it->second.hot)
+    it->second.commits++;
+}
 
-  // Read everything in from readset.
-  for (set<Key>::iterator it = txn->readset_.begin();
+void TxnProcessor::UpdateHot(Temperature* temperature) {
+  bool hot =
+      temperature->aborts >= HOT_RATIO * (temperature->commits + HOT_PRIOR);
+  if (hot != temperature->hot) {
+    temperature->hot = hot;
+    hot_keys_ += hot ? 1 : -1;
+  }
+}
+
+void TxnProcessor::CoolDown() {
+  double now = GetTime();
+  if (now < last_cooldown_ + COOLDOWN_INTERVAL)
+    return;
+  last_cooldown_ = now;
+
+  for (unordered_map<Key, Temperature>::iterator it = temperature_.begin();
+       it != temperature_.end();) {
+    it->second.aborts /= 2;
+    it->second.commits /= 2;
+    UpdateHot(&it->second);
+    if (it->second.aborts == 0 && it->second.commits == 0)
+      it = temperature_.erase(it);
+    else
+      ++it;
+  }
+}
+
+void TxnProcessor::RunSnapshotScheduler() {
+  Txn* txn;
+  while (SchedulerActive()) {
+    // Start processing the next incoming transaction request. Its snapshot
+    // includes every txn committed so far.
+    if (Admit(&txn)) {
+      txn->occ_start_time_ = GetTime();
+      txn->start_ts_ = last_commit_ts_;
+      active_snapshots_.insert(txn->start_ts_);
+
+      // Leave SIREAD markers on everything the txn reads, so that concurrent
+      // writers can detect rw-antidependencies from it.
+      if (mode_ == SSI) {
+        txn->ssi_.reset(new SSIInfo(txn->start_ts_));
+        for (KeySet::iterator it = txn->readset_.begin();
+             it != txn->readset_.end(); ++it) {
+          readers_[*it].push_back(txn->ssi_);
+        }
+      }
+
+      tp_.RunTask(InlineTask(this, &TxnProcessor::ExecuteSnapshotTxn, txn));
+    }
+
+    // Commit/abort all transactions that have finished running.
+    while (completed_txns_.Pop(&txn)) {
+      active_snapshots_.erase(active_snapshots_.find(txn->start_ts_));
+
+      if (txn->Status() == COMPLETED_C) {
+        if (SnapshotConflict(txn)) {
+          // Try transaction again on a fresh snapshot.
+          if (txn->ssi_)
+            txn->ssi_->aborted_ = true;
+          Restart(txn);
+          continue;
+        }
+        CommitSnapshotTxn(txn);
+      } else if (txn->Status() == COMPLETED_A) {
+        if (txn->ssi_)
+          txn->ssi_->aborted_ = true;
+        txn->status_ = ABORTED;
+      } else {
+        // Invalid TxnStatus!
+        DIE("Completed Txn has invalid TxnStatus: " << txn->Status());
+      }
+
+      // Return result to client.
+      Finish(txn);
+    }
+
+    if (mode_ == SSI)
+      PruneSSI();
+  }
+}
+
+void TxnProcessor::ExecuteSnapshotTxn(Txn* txn) {
+  // wipe reads_, writes_ and deltas_
+  txn->reads_.clear();
+  txn->writes_.clear();
+  txn->deltas_.clear();
+
+  // Execute txn's program logic, reading records as of the txn's snapshot as
+  // it needs them. The snapshot's versions are kept until the txn completes.
+  RunOnDemand(txn);
+
+  // Hand the txn back to the RunScheduler thread.
+  completed_txns_.Push(tp_.WorkerIndex(), txn);
+  wakeup_.Notify();
+}
+
+bool TxnProcessor::SnapshotConflict(Txn* txn) {
+  // First committer wins: abort if anyone committed a write to one of our
+  // keys after our snapshot was taken. Commutative updates are exempt.
+  for (KeySet::iterator it = txn->writeset_.begin();
+       it != txn->writeset_.end(); ++it) {
+    if (mv_storage_.Timestamp(*it) > txn->start_ts_)
+      return true;
+  }
+
+  if (mode_ != SSI)
+    return false;
+
+  SSIInfo* self = txn->ssi_.get();
+  bool in_conflict = self->in_conflict_;
+  bool out_conflict = self->out_conflict_;
+
+  // Out-conflicts: txns that committed a newer version of something we read
+  // (us -rw-> them). If such a writer already has an out-conflict of its own,
+  // it is a committed pivot, and only we can still be aborted.
+  vector<SSIInfo*> overwriters;
+  for (KeySet::iterator it = txn->readset_.begin();
        it != txn->readset_.end(); ++it) {
-    // Save each read result iff record exists in storage.
-    Value result;
-    if (storage_.Read(*it, &result))
-      txn->reads_[*it] = result;
+    vector<shared_ptr<SSIInfo> >& writers = writers_[*it];
+    for (uint32 i = 0; i < writers.size(); i++) {
+      SSIInfo* writer = writers[i].get();
+      if (writer->commit_ts_ <= self->start_ts_)
+        continue;
+      if (writer->out_conflict_)
+        return true;
+      out_conflict = true;
+      overwriters.push_back(writer);
+    }
+  }
+
+  // In-conflicts: concurrent txns that read an older version of something we
+  // are about to write or update (them -rw-> us). A committed reader that
+  // already has an in-conflict would become a committed pivot.
+  vector<SSIInfo*> readers;
+  KeySet updated(txn->writeset_);
+  updated.insert(txn->deltaset_.begin(), txn->deltaset_.end());
+  for (KeySet::iterator it = updated.begin(); it != updated.end(); ++it) {
+    vector<shared_ptr<SSIInfo> >& key_readers = readers_[*it];
+    for (uint32 i = 0; i < key_readers.size(); i++) {
+      SSIInfo* reader = key_readers[i].get();
+      if (reader == self || reader->aborted_)
+        continue;
+      if (reader->commit_ts_ != 0 && reader->commit_ts_ <= self->start_ts_)
+        continue;
+      if (reader->commit_ts_ != 0 && reader->in_conflict_)
+        return true;
+      in_conflict = true;
+      readers.push_back(reader);
+    }
+  }
+
+  // We would be a pivot ourselves.
+  if (in_conflict && out_conflict)
+    return true;
+
+  // Safe to commit: record the new edges on both ends.
+  self->in_conflict_ = in_conflict;
+  self->out_conflict_ = out_conflict;
+  for (uint32 i = 0; i < overwriters.size(); i++)
+    overwriters[i]->in_conflict_ = true;
+  for (uint32 i = 0; i < readers.size(); i++)
+    readers[i]->out_conflict_ = true;
+  return false;
+}
+
+void TxnProcessor::CommitSnapshotTxn(Txn* txn) {
+  uint64 commit_ts = ++last_commit_ts_;
+
+  // Versions older than the oldest snapshot still in use can be discarded.
+  uint64 low_water = active_snapshots_.empty() ? last_commit_ts_
+                                               : *active_snapshots_.begin();
+  for (ValueMap::iterator it = txn->writes_.begin();
+       it != txn->writes_.end(); ++it) {
+    mv_storage_.Write(it->first, it->second, commit_ts, low_water);
   }
 
-  // Also read everything in from writeset.
-  for (set<Key>::iterator it = txn->writeset_.begin();
+  // Commutative updates are merged into the newest version rather than the
+  // txn's snapshot, so concurrent ones never conflict.
+  for (DeltaMap::iterator it = txn->deltas_.begin();
+       it != txn->deltas_.end(); ++it) {
+    Value value = 0;
+    bool exists = mv_storage_.Read(it->first, &value, commit_ts);
+    mv_storage_.Write(it->first,
+                      ApplyDelta(it->second.op_, exists, value,
+                                 it->second.arg_),
+                      commit_ts, low_water);
+  }
+
+  if (txn->ssi_) {
+    txn->ssi_->commit_ts_ = commit_ts;
+    for (KeySet::iterator it = txn->writeset_.begin();
+         it != txn->writeset_.end(); ++it) {
+      writers_[*it].push_back(txn->ssi_);
+    }
+    for (KeySet::iterator it = txn->deltaset_.begin();
+         it != txn->deltaset_.end(); ++it) {
+      writers_[*it].push_back(txn->ssi_);
+    }
+  }
+
+  txn->status_ = COMMITTED;
+}
+
+// Interval, in seconds, at which SSI conflict records are pruned.
+#define PRUNE_INTERVAL 0.05
+
+// Returns true if an SSI record can no longer matter to any active txn: it
+// either never committed, or committed before the oldest active snapshot.
+static bool Obsolete(const shared_ptr<SSIInfo>& info, uint64 low_water) {
+  return info->aborted_ ||
+         (info->commit_ts_ != 0 && info->commit_ts_ <= low_water);
+}
+
+void TxnProcessor::PruneSSI() {
+  double now = GetTime();
+  if (now < last_prune_ + PRUNE_INTERVAL)
+    return;
+  last_prune_ = now;
+
+  uint64 low_water = active_snapshots_.empty() ? last_commit_ts_
+                                               : *active_snapshots_.begin();
+  unordered_map<Key, vector<shared_ptr<SSIInfo> > >* tables[] = {
+    &readers_, &writers_
+  };
+  for (int t = 0; t < 2; t++) {
+    unordered_map<Key, vector<shared_ptr<SSIInfo> > >::iterator it;
+    for (it = tables[t]->begin(); it != tables[t]->end();) {
+      vector<shared_ptr<SSIInfo> >& infos = it->second;
+      uint32 kept = 0;
+      for (uint32 i = 0; i < infos.size(); i++) {
+        if (!Obsolete(infos[i], low_water))
+          infos[kept++] = infos[i];
+      }
+      infos.resize(kept);
+      if (infos.empty())
+        it = tables[t]->erase(it);
+      else
+        ++it;
+    }
+  }
+}
+
+void TxnProcessor::RunTimestampScheduler() {
+  Txn* txn;
+  while (SchedulerActive()) {
+    // Start processing the next incoming transaction request. Nothing is read
+    // up front: every access goes through 'OnRead()'/'OnWrite()'. Timestamps
+    // increase in admission order, so no txn is ever older than a version
+    // that MVTO has already discarded.
+    if (Admit(&txn)) {
+      txn->start_ts_ = next_ts_++;
+      active_snapshots_.insert(txn->start_ts_);
+      txn->reads_.clear();
+      txn->writes_.clear();
+      txn->deltas_.clear();
+      txn->hook_ = this;
+      txn->doomed_ = false;
+      txn->occ_start_time_ = GetTime();
+      tp_.RunTask(InlineTask(this, &TxnProcessor::RunTimestampTxn, txn));
+    }
+
+    // Commit/abort all transactions that have finished running.
+    while (completed_txns_.Pop(&txn)) {
+      active_snapshots_.erase(active_snapshots_.find(txn->start_ts_));
+      txn->hook_ = NULL;
+
+      // Every key in 'writes_' was successfully prewritten.
+      if (txn->doomed_ || txn->Status() == COMPLETED_A) {
+        for (ValueMap::iterator it = txn->writes_.begin();
+             it != txn->writes_.end(); ++it) {
+          to_storage_.Abort(it->first, txn->start_ts_);
+        }
+      }
+
+      if (txn->doomed_) {
+        // Try transaction again with a new timestamp.
+        Restart(txn);
+        continue;
+      }
+
+      if (txn->Status() == COMPLETED_C) {
+        // Versions older than the oldest active txn can be discarded.
+        uint64 low_water = active_snapshots_.empty()
+                               ? txn->start_ts_ : *active_snapshots_.begin();
+        for (ValueMap::iterator it = txn->writes_.begin();
+             it != txn->writes_.end(); ++it) {
+          to_storage_.Commit(it->first, txn->start_ts_, it->second, low_water);
+        }
+        txn->status_ = COMMITTED;
+      } else if (txn->Status() == COMPLETED_A) {
+        txn->status_ = ABORTED;
+      } else {
+        // Invalid TxnStatus!
+        DIE("Completed Txn has invalid TxnStatus: " << txn->Status());
+      }
+
+      // Return result to client.
+      Finish(txn);
+    }
+  }
+}
+
+void TxnProcessor::RunTimestampTxn(Txn* txn) {
+  txn->Run();
+
+  // Versions are ordered by timestamp, so a commutative update cannot simply
+  // be merged into the newest one. Instead it becomes an ordinary
+  // read-modify-write at the txn's timestamp.
+  if (txn->Status() == COMPLETED_C) {
+    for (DeltaMap::iterator it = txn->deltas_.begin();
+         !txn->doomed_ && it != txn->deltas_.end(); ++it) {
+      Value value = 0;
+      bool exists = OnRead(txn, it->first, &value);
+      if (!txn->doomed_)
+        OnWrite(txn, it->first);
+      if (!txn->doomed_) {
+        txn->writes_[it->first] =
+            ApplyDelta(it->second.op_, exists, value, it->second.arg_);
+      }
+    }
+  }
+
+  // Hand the txn back to the RunScheduler thread.
+  completed_txns_.Push(tp_.WorkerIndex(), txn);
+  wakeup_.Notify();
+}
+
+bool TxnProcessor::OnRead(Txn* txn, const Key& key, Value* value) {
+  // Bamboo reads every existing record before the txn starts.
+  if (mode_ == BAMBOO)
+    return false;
+
+  if (mode_ == TO || mode_ == MVTO) {
+    bool rejected = false;
+    bool found = to_storage_.Read(key, txn->start_ts_, value, &rejected);
+    if (rejected)
+      txn->doomed_ = true;
+    return found;
+  }
+
+  // Check the record's version only after reading it, so that the value read
+  // is at least as old as the version checked.
+  bool found = storage_.Read(key, value);
+  if (storage_.Timestamp(key) > txn->occ_start_time_) {
+    txn->doomed_ = true;
+    return false;
+  }
+  return found;
+}
+
+void TxnProcessor::OnWrite(Txn* txn, const Key& key) {
+  if (mode_ == BAMBOO)
+    return;
+
+  if (mode_ == TO || mode_ == MVTO) {
+    if (!to_storage_.Prewrite(key, txn->start_ts_))
+      txn->doomed_ = true;
+    return;
+  }
+
+  // A blind write does not depend on the record's current version.
+  if (!txn->blindset_.count(key) &&
+      storage_.Timestamp(key) > txn->occ_start_time_)
+    txn->doomed_ = true;
+}
+
+void TxnProcessor::RunBambooScheduler() {
+  Txn* txn;
+  while (SchedulerActive()) {
+    // Start processing the next incoming transaction request, exactly as
+    // Locking B does.
+    if (Admit(&txn)) {
+      if (txn->ReadOnly()) {
+        // Read-only txns never touch the lock table, and only see committed
+        // writes.
+        StartReadOnlyTxn(txn);
+      } else {
+        int blocked = 0;
+        for (KeySet::iterator it = txn->readset_.begin();
+             it != txn->readset_.end(); ++it) {
+          if (txn->writeset_.count(*it))
+            continue;
+          if (!lm_->ReadLock(txn, *it))
+            blocked++;
+        }
+        for (KeySet::iterator it = txn->writeset_.begin();
+             it != txn->writeset_.end(); ++it) {
+          if (!lm_->WriteLock(txn, *it))
+            blocked++;
+        }
+        for (KeySet::iterator it = txn->deltaset_.begin();
+             it != txn->deltaset_.end(); ++it) {
+          if (!lm_->CommuteLock(txn, *it))
+            blocked++;
+        }
+        if (blocked == 0)
+          ready_txns_.push_back(txn);
+      }
+    }
+
+    // Hand retired keys on to the next txns waiting for them.
+    ProcessRetirements();
+
+    // Process all transactions that have finished running.
+    while (completed_txns_.Pop(&txn)) {
+      if (txn->ReadOnly()) {
+        FinishReadOnlyTxn(txn);
+        continue;
+      }
+
+      // The txn retired any key before completing, so its retirements are
+      // already queued.
+      ProcessRetirements();
+      txn->hook_ = NULL;
+
+      if (txn->doomed_) {
+        // Its writes were withdrawn and its dependents aborted when it was
+        // doomed. Try it again.
+        ReleaseLocks(txn);
+        ReleaseCommutativeLocks(txn);
+        bamboo_.erase(txn);
+        Restart(txn);
+        continue;
+      }
+
+      BambooInfo& info = bamboo_[txn];
+      if (txn->Status() == COMPLETED_C) {
+        // Keys that were never retired are retired now, so that other txns
+        // need not wait for this one's dependencies to commit.
+        for (ValueMap::iterator it = txn->writes_.begin();
+             it != txn->writes_.end(); ++it) {
+          if (info.published.insert(it->first))
+            dirty_[it->first].push_back(std::make_pair(txn, it->second));
+        }
+      } else if (txn->Status() == COMPLETED_A) {
+        Cascade(txn);
+      } else {
+        // Invalid TxnStatus!
+        DIE("Completed Txn has invalid TxnStatus: " << txn->Status());
+      }
+      ReleaseLocks(txn);
+
+      // The txn's vote only stands once everything it read has committed.
+      info.completed = true;
+      if (info.depends_on.empty())
+        Resolve(txn);
+    }
+
+    // Start executing all transactions that have newly acquired all their
+    // locks.
+    while (ready_txns_.size()) {
+      txn = ready_txns_.front();
+      ready_txns_.pop_front();
+      StartBambooTxn(txn);
+    }
+  }
+}
+
+void TxnProcessor::OnRetire(Txn* txn, const Key& key) {
+  if (mode_ == BAMBOO) {
+    retired_.Push(tp_.WorkerIndex(),
+                  std::make_pair(txn, *txn->writes_.find(key)));
+    wakeup_.Notify();
+  }
+}
+
+void TxnProcessor::ProcessRetirements() {
+  std::pair<Txn*, std::pair<Key, Value> > retirement;
+  while (retired_.Pop(&retirement)) {
+    Txn* txn = retirement.first;
+    const Key& key = retirement.second.first;
+
+    // A doomed txn's writes will never commit, so there is nothing to
+    // publish; the lock is still released early.
+    if (!txn->doomed_) {
+      bamboo_[txn].published.insert(key);
+      dirty_[key].push_back(std::make_pair(txn, retirement.second.second));
+    }
+    lm_->Release(txn, key);
+  }
+}
+
+void TxnProcessor::ReleaseLocks(Txn* txn) {
+  // Releasing a lock that was already retired has no effect. Commutative
+  // locks are held until the txn commits or aborts, since their updates are
+  // never published early.
+  for (KeySet::iterator it = txn->readset_.begin();
+       it != txn->readset_.end(); ++it) {
+    lm_->Release(txn, *it);
+  }
+  for (KeySet::iterator it = txn->writeset_.begin();
+       it != txn->writeset_.end(); ++it) {
+    lm_->Release(txn, *it);
+  }
+}
+
+void TxnProcessor::ReleaseCommutativeLocks(Txn* txn) {
+  for (KeySet::iterator it = txn->deltaset_.begin();
+       it != txn->deltaset_.end(); ++it) {
+    lm_->Release(txn, *it);
+  }
+}
+
+void TxnProcessor::StartBambooTxn(Txn* txn) {
+  txn->reads_.clear();
+  txn->writes_.clear();
+  txn->deltas_.clear();
+  txn->hook_ = this;
+  txn->doomed_ = false;
+  txn->occ_start_time_ = GetTime();
+
+  BambooInfo& info = bamboo_[txn];
+  KeySet keys(txn->readset_);
+  keys.insert(txn->writeset_.begin(), txn->writeset_.end());
+  for (KeySet::iterator it = keys.begin(); it != keys.end(); ++it) {
+    unordered_map<Key, deque<std::pair<Txn*, Value> > >::iterator dirty =
+        dirty_.find(*it);
+    if (dirty != dirty_.end()) {
+      // Whoever retired the key last is the only one that can hold the lock
+      // txn was just granted, so its value is the one txn must see.
+      Txn* writer = dirty->second.back().first;
+      txn->reads_[*it] = dirty->second.back().second;
+      info.depends_on.insert(writer);
+      bamboo_[writer].dependents.insert(txn);
+    } else {
+      Value result;
+      if (storage_.Read(*it, &result))
+        txn->reads_[*it] = result;
+    }
+  }
+
+  // Commutative updates are merged into storage, so they must not be applied
+  // before the writes they follow.
+  for (KeySet::iterator it = txn->deltaset_.begin();
+       it != txn->deltaset_.end(); ++it) {
+    unordered_map<Key, deque<std::pair<Txn*, Value> > >::iterator dirty =
+        dirty_.find(*it);
+    if (dirty != dirty_.end()) {
+      Txn* writer = dirty->second.back().first;
+      info.depends_on.insert(writer);
+      bamboo_[writer].dependents.insert(txn);
+    }
+  }
+
+  // Start txn running in its own thread.
+  tp_.RunTask(InlineTask(this, &TxnProcessor::RunTxn, txn));
+}
+
+// Removes 'txn's entry from the uncommitted values of 'key'.
+static void Withdraw(unordered_map<Key, deque<std::pair<Txn*, Value> > >* dirty,
+                     Txn* txn, const Key& key) {
+  deque<std::pair<Txn*, Value> >& values = (*dirty)[key];
+  for (deque<std::pair<Txn*, Value> >::iterator it = values.begin();
+       it != values.end(); ++it) {
+    if (it->first == txn) {
+      values.erase(it);
+      break;
+    }
+  }
+  if (values.empty())
+    dirty->erase(key);
+}
+
+void TxnProcessor::Cascade(Txn* txn) {
+  vector<Txn*> victims(1, txn);
+  while (!victims.empty()) {
+    Txn* victim = victims.back();
+    victims.pop_back();
+    BambooInfo& info = bamboo_[victim];
+
+    for (KeySet::iterator it = info.published.begin();
+         it != info.published.end(); ++it) {
+      Withdraw(&dirty_, victim, *it);
+    }
+    info.published.clear();
+
+    for (set<Txn*>::iterator it = info.dependents.begin();
+         it != info.dependents.end(); ++it) {
+      if (!(*it)->doomed_) {
+        (*it)->doomed_ = true;
+        victims.push_back(*it);
+      }
+    }
+    info.dependents.clear();
+
+    // 'txn' itself aborted by its own vote, which still stands only once its
+    // dependencies commit. Its victims are retried instead.
+    if (victim == txn)
+      continue;
+    for (set<Txn*>::iterator it = info.depends_on.begin();
+         it != info.depends_on.end(); ++it) {
+      bamboo_[*it].dependents.erase(victim);
+    }
+    if (info.completed) {
+      ReleaseCommutativeLocks(victim);
+      bamboo_.erase(victim);
+      Restart(victim);
+    }
+  }
+}
+
+void TxnProcessor::Resolve(Txn* txn) {
+  vector<Txn*> ready(1, txn);
+  while (!ready.empty()) {
+    Txn* next = ready.back();
+    ready.pop_back();
+    BambooInfo& info = bamboo_[next];
+
+    if (next->Status() == COMPLETED_C) {
+      ApplyWrites(next);
+      for (KeySet::iterator it = info.published.begin();
+           it != info.published.end(); ++it) {
+        Withdraw(&dirty_, next, *it);
+      }
+    } else {
+      next->status_ = ABORTED;
+    }
+    ReleaseCommutativeLocks(next);
+
+    for (set<Txn*>::iterator it = info.dependents.begin();
+         it != info.dependents.end(); ++it) {
+      BambooInfo& dependent = bamboo_[*it];
+      dependent.depends_on.erase(next);
+      if (dependent.completed && dependent.depends_on.empty())
+        ready.push_back(*it);
+    }
+
+    bamboo_.erase(next);
+    Finish(next);
+  }
+}
+
+void TxnProcessor::Watch(Txn* txn) {
+  txn->hook_ = this;
+  txn->doomed_ = false;
+  invalidator_.Watch(txn);
+}
+
+void TxnProcessor::Unwatch(Txn* txn) {
+  invalidator_.Unwatch(txn);
+  txn->hook_ = NULL;
+}
+
+// Interval, in seconds, at which the invalidator checks for new updates when
+// there were none.
+#define NOTIFY_INTERVAL 0.0001
+
+void TxnProcessor::RunInvalidator() {
+  while (tp_.Active()) {
+    if (!invalidator_.Notify())
+      Sleep(NOTIFY_INTERVAL);
+  }
+}
+
+bool TxnProcessor::RepairTxn(Txn* txn, const KeySet& stale) {
+  stats_.restarted++;
+  txn->restarts_++;
+
+  // Writes are only ever applied by this thread, so re-reading the stale
+  // records here brings every read up to date as of now. Nothing else the txn
+  // read has changed since it started.
+  double now = GetTime();
+  for (KeySet::const_iterator it = stale.begin(); it != stale.end(); ++it)
+    Reread(txn, *it);
+
+  // If the txn can redo just the affected part of its logic, it is valid as
+  // soon as that is done: nothing can have been written in the meantime.
+  // Records it reads for the first time are read on demand as usual.
+  txn->status_ = INCOMPLETE;
+  txn->hook_ = &on_demand_;
+  bool repaired = txn->Repair(stale);
+  txn->hook_ = NULL;
+  if (repaired) {
+    txn->status_ = COMPLETED_C;
+    ApplyWrites(txn);
+    return true;
+  }
+
+  // Otherwise re-run all of its logic, but against the reads it already has.
+  // Its own writes shadow the values it read, so those are re-read too.
+  txn->wasted_time_ += now - txn->occ_start_time_;
+  for (ValueMap::iterator it = txn->writes_.begin();
+       it != txn->writes_.end(); ++it) {
+    Reread(txn, it->first);
+  }
+  txn->writes_.clear();
+  txn->deltas_.clear();
+
+  // Timestamps have a resolution of one microsecond, so a write applied right
+  // after the reads above might not look newer than 'now'. Backdating the
+  // start makes sure that it does.
+  txn->occ_start_time_ = now - 0.000001;
+  if (options_ & EARLY_ABORT)
+    Watch(txn);
+  tp_.RunTask(InlineTask(this, &TxnProcessor::RerunTxn, txn));
+  return false;
+}
+
+void TxnProcessor::Reread(Txn* txn, const Key& key) {
+  Value result;
+  if (storage_.Read(key, &result))
+    txn->reads_[key] = result;
+  else
+    txn->reads_.erase(key);
+}
+
+void TxnProcessor::ValidateTxn(Txn *txn) {
+  // ensure that status is COMPLETED_C
+  if (txn->Status() == COMPLETED_A) {
+    txn->status_ = ABORTED;
+    txn->active_ = ActiveSet::Snapshot();
+    validated_txns_.Push(tp_.WorkerIndex(), std::make_pair(txn, true));
+    wakeup_.Notify();
+    return;
+  } else if (txn->Status() != COMPLETED_C) {
+    DIE("Completed Txn has invalid TxnStatus: " << txn->Status());
+  }
+
+  bool verified = true;
+
+  // check for overlap in readset
+  for (KeySet::iterator it = txn->readset_.begin();
+       it != txn->readset_.end(); ++it) {
+    // if last modified > my start then invalid
+    if (storage_.Timestamp(*it) > txn->occ_start_time_) {
+      verified = false;
+      break;
+    }
+  }
+
+  // check for overlap in writeset (blind writes cannot go stale, but they
+  // still conflict with concurrently validating txns below)
+  for (KeySet::iterator it = txn->writeset_.begin();
        it != txn->writeset_.end(); ++it) {
-    // Save each read result iff record exists in storage.
-    Value result;
-    if (storage_.Read(*it, &result))
-      txn->reads_[*it] = result;
+    if (txn->blindset_.count(*it))
+      continue;
+    // if last modified > my start then invalid
+    if (storage_.Timestamp(*it) > txn->occ_start_time_) {
+      verified = false;
+      break;
+    }
+  }
+
+  // check if the writeset intersects with the read or write sets
+  // of any concurrently validating txns
+  for (ActiveSet::Snapshot::Iterator it = txn->active_.Begin();
+       verified && !it.Done(); it.Next()) {
+    for (KeySet::iterator it2 = txn->writeset_.begin();
+        it2 != txn->writeset_.end(); ++it2) {
+      verified = verified && !it.txn()->writeset_.count(*it2) &&
+                 !it.txn()->readset_.count(*it2) &&
+                 !it.txn()->deltaset_.count(*it2);
+      if (!verified) break;
+    }
+
+    // Commutative updates only conflict with reads and writes, in either
+    // direction.
+    for (KeySet::iterator it2 = txn->deltaset_.begin();
+        verified && it2 != txn->deltaset_.end(); ++it2) {
+      verified = !it.txn()->writeset_.count(*it2) &&
+                 !it.txn()->readset_.count(*it2);
+    }
+    for (KeySet::iterator it2 = txn->readset_.begin();
+        verified && it2 != txn->readset_.end(); ++it2) {
+      verified = !it.txn()->deltaset_.count(*it2);
+    }
   }
 
+  if (verified) ApplyWrites(txn);
+  txn->active_ = ActiveSet::Snapshot();
+  validated_txns_.Push(tp_.WorkerIndex(), std::make_pair(txn, verified));
+  wakeup_.Notify();
+}
+
+
+void TxnProcessor::StartReadOnlyTxn(Txn* txn) {
+  // Every write in this mode is applied by the scheduler thread, so the
+  // committed state as of this point is a consistent snapshot. The txn is
+  // serialized here; it reads the snapshot on its worker, and its logic can
+  // run without locks or validation.
+  txn->reads_.clear();
+  txn->writes_.clear();
+  txn->start_ts_ = last_commit_ts_;
+  active_snapshots_.insert(txn->start_ts_);
+  txn->hook_ = &snapshot_reads_;
+
+  tp_.RunTask(InlineTask(this, &TxnProcessor::RunTxn, txn));
+}
+
+void TxnProcessor::FinishReadOnlyTxn(Txn* txn) {
+  txn->hook_ = NULL;
+  active_snapshots_.erase(active_snapshots_.find(txn->start_ts_));
+  if (active_snapshots_.empty())
+    snapshot_log_.Clear();
+
+  if (txn->Status() == COMPLETED_C) {
+    txn->status_ = COMMITTED;
+  } else if (txn->Status() == COMPLETED_A) {
+    txn->status_ = ABORTED;
+  } else {
+    // Invalid TxnStatus!
+    DIE("Completed Txn has invalid TxnStatus: " << txn->Status());
+  }
+  Finish(txn);
+}
+
+void TxnProcessor::RunTxn(Txn* txn) {
   // Execute txn's program logic.
   txn->Run();
 
   // Hand the txn back to the RunScheduler thread.
-  completed_txns_.Push(txn);
+  completed_txns_.Push(tp_.WorkerIndex(), txn);
+  wakeup_.Notify();
+}
+
+void TxnProcessor::ExecuteTxn(Txn* txn) {
+  ReadAndRun(txn);
+
+  // Hand the txn back to the RunScheduler thread.
+  completed_txns_.Push(tp_.WorkerIndex(), txn);
+  wakeup_.Notify();
+}
+
+void TxnProcessor::ReadAndRun(Txn* txn) {
+  // wipe reads_, writes_ and deltas_
+  txn->reads_.clear();
+  txn->writes_.clear();
+  txn->deltas_.clear();
+
+  // Execute txn's program logic. Records are read as the txn needs them, so
+  // declared keys that it never reads (e.g. blind writes) cost nothing.
+  RunOnDemand(txn);
+}
+
+void TxnProcessor::RerunTxn(Txn* txn) {
+  RunOnDemand(txn);
+
+  // Hand the txn back to the RunScheduler thread.
+  completed_txns_.Push(tp_.WorkerIndex(), txn);
+  wakeup_.Notify();
+}
+
+void TxnProcessor::RunOnDemand(Txn* txn) {
+  // With early abort, records are already read (and checked) through this
+  // TxnProcessor's own 'OnRead()'.
+  if (txn->hook_ != NULL) {
+    txn->Run();
+    return;
+  }
+
+  txn->hook_ = &on_demand_;
+  txn->Run();
+  txn->hook_ = NULL;
+}
+
+bool TxnProcessor::OnDemandReads::OnRead(Txn* txn, const Key& key,
+                                         Value* value) {
+  if (processor_->mode_ == SI || processor_->mode_ == SSI)
+    return processor_->mv_storage_.Read(key, value, txn->start_ts_);
+  return processor_->storage_.Read(key, value);
+}
+
+bool TxnProcessor::SnapshotReads::OnRead(Txn* txn, const Key& key,
+                                         Value* value) {
+  // The record is read before the log is checked: the scheduler logs what a
+  // record holds before overwriting it, so if this read already saw a newer
+  // value, the log has the one the snapshot should see.
+  bool exists = processor_->storage_.Read(key, value);
+  processor_->snapshot_log_.Read(key, txn->start_ts_, &exists, value);
+  return exists;
 }
 
 void TxnProcessor::ApplyWrites(Txn* txn) {
+  // Read-only txns may still be reading snapshots taken before this write.
+  if (!active_snapshots_.empty()) {
+    uint64 ts = ++last_commit_ts_;
+    uint64 low_water = *active_snapshots_.begin();
+    for (ValueMap::iterator it = txn->writes_.begin();
+         it != txn->writes_.end(); ++it) {
+      Value value = 0;
+      bool exists = storage_.Read(it->first, &value);
+      snapshot_log_.Overwrite(it->first, exists, value, ts, low_water);
+    }
+    for (DeltaMap::iterator it = txn->deltas_.begin();
+         it != txn->deltas_.end(); ++it) {
+      Value value = 0;
+      bool exists = storage_.Read(it->first, &value);
+      snapshot_log_.Overwrite(it->first, exists, value, ts, low_water);
+    }
+  }
+
   // Write buffered writes out to storage.
-  for (map<Key, Value>::iterator it = txn->writes_.begin();
+  for (ValueMap::iterator it = txn->writes_.begin();
        it != txn->writes_.end(); ++it) {
     storage_.Write(it->first, it->second);
+    if (options_ & EARLY_ABORT)
+      invalidator_.Updated(it->first, storage_.Timestamp(it->first));
+  }
+
+  // Merge commutative updates into whatever the records hold by now.
+  for (DeltaMap::iterator it = txn->deltas_.begin();
+       it != txn->deltas_.end(); ++it) {
+    storage_.Apply(it->first, it->second);
+    if (options_ & EARLY_ABORT)
+      invalidator_.Updated(it->first, storage_.Timestamp(it->first));
   }
 
   // Set status to committed.
@@ -8,56 +8,277 @@
 #include <map>
 #include <string>
 #include <set>
+#include <vector>
 #include <algorithm>
 #include <utility>
 
+#include "txn/active_set.h"
 #include "txn/common.h"
+#include "txn/invalidator.h"
 #include "txn/lock_manager.h"
 #include "txn/storage.h"
 #include "txn/txn.h"
 #include "utils/atomic.h"
+#include "utils/event_count.h"
+#include "utils/spsc_ring.h"
 #include "utils/static_thread_pool.h"
 #include "utils/mutex.h"
 
 using std::deque;
 using std::map;
+using std::multimap;
+using std::multiset;
 using std::string;
+using std::vector;
 
 // The TxnProcessor supports five different execution modes, corresponding to
 // the four parts of assignment 2, plus a simple serial (non-concurrent) mode.
+// It additionally supports a hybrid mode that locks hot keys and validates
+// cold ones, an adaptive mode that switches between the others at run time,
+// two multiversion snapshot isolation modes, two timestamp ordering modes, and
+// a locking mode with early lock release.
 enum CCMode {
   SERIAL = 0,                  // Serial transaction execution (no concurrency)
   LOCKING_EXCLUSIVE_ONLY = 1,  // Part 1A
   LOCKING = 2,                 // Part 1B
   OCC = 3,                     // Part 2
   P_OCC = 4,                   // Part 3
+  MOCC = 5,                    // Mostly-optimistic (locks on hot keys only)
+  ADAPTIVE = 6,                // Switches between SERIAL/LOCKING/(P_)OCC
+  SI = 7,                      // Snapshot isolation (first committer wins)
+  SSI = 8,                     // Serializable snapshot isolation
+  TO = 9,                      // Basic timestamp ordering
+  MVTO = 10,                   // Multiversion timestamp ordering
+  BAMBOO = 11,                 // Locking B, releasing retired write locks early
+};
+
+// Optional behaviors, which may be combined (bitwise or) and passed to the
+// TxnProcessor's constructor.
+enum CCOption {
+  EARLY_ABORT = 1 << 0,     // OCC, OCC-P: abort stale txns while they run
+  REPAIR = 1 << 1,          // OCC: repair txns that fail validation in place
+  RETRY_QUEUE = 1 << 2,     // OCC, OCC-P: prioritized retries with backoff
+  SPLIT_HOT_KEYS = 1 << 3,  // Split records with many commutative updates
+  PIN_THREADS = 1 << 4,     // Pin the scheduler and workers to CPUs
 };
 
 // Returns a human-readable string naming of the providing mode.
 string ModeToString(CCMode mode);
 
-class TxnProcessor {
+class TxnProcessor;
+
+// A client's own channel to a TxnProcessor. Requests made through a session
+// skip the lock that orders requests from 'TxnProcessor::NewTxnRequest()',
+// and their results come back only through the same session, never through
+// 'TxnProcessor::GetTxnResult()' or another session. Each session should be
+// used by one client thread at a time. Sessions are created by, and belong
+// to, a TxnProcessor (see 'TxnProcessor::NewSession()').
+class TxnSession {
+ public:
+  // Like the TxnProcessor methods of the same names, but for this session's
+  // txns only.
+  void NewTxnRequest(Txn* txn);
+  void NewTxnRequests(Txn** txns, int n);
+  Txn* GetTxnResult();
+  bool GetTxnResult(Txn** txn, double timeout);
+  int GetTxnResults(Txn** txns, int max, double timeout = -1);
+
+ private:
+  friend class TxnProcessor;
+
+  explicit TxnSession(TxnProcessor* processor)
+      : processor_(processor), next_(NULL) {}
+
+  // Completion callback of this session's txns.
+  void Deliver(Txn* txn);
+
+  TxnProcessor* processor_;
+
+  // Requests not yet admitted by the scheduler.
+  AtomicQueue<Txn*> requests_;
+
+  // Results not yet taken by the client, and notified after each push.
+  AtomicQueue<Txn*> results_;
+  EventCount results_ready_;
+
+  // Next (older) session of the same TxnProcessor.
+  TxnSession* next_;
+
+  // Sessions are shared by address, so they cannot be copied.
+  TxnSession(const TxnSession&);
+  TxnSession& operator=(const TxnSession&);
+};
+
+// Result of a txn request made with 'TxnProcessor::NewTxnRequest(txn,
+// future)'. The client owns the TxnFuture, which must stay alive until the
+// txn is ready.
+class TxnFuture {
+ public:
+  TxnFuture() : txn_(NULL), ready_(false), event_(NULL) {}
+
+  // Returns true once the txn has committed or aborted.
+  bool Ready() const;
+
+  // Waits up to 'timeout' seconds (forever if 'timeout' is negative) for the
+  // txn to commit or abort. Returns the txn, whose ownership passes back to
+  // the caller, or NULL if it is not ready in time. Returns NULL right away
+  // if no request was made with this future.
+  Txn* Get(double timeout = -1);
+
+ private:
+  friend class TxnProcessor;
+
+  // The requested txn.
+  Txn* txn_;
+
+  // Set once the txn is ready.
+  std::atomic<bool> ready_;
+
+  // Notified by the TxnProcessor whenever any future becomes ready.
+  EventCount* event_;
+
+  // Futures are handed to the TxnProcessor by address, so they cannot be
+  // copied.
+  TxnFuture(const TxnFuture&);
+  TxnFuture& operator=(const TxnFuture&);
+};
+
+class TxnProcessor : public AccessHook {
  public:
   // The TxnProcessor's constructor starts the TxnProcessor running in the
-  // background.
-  explicit TxnProcessor(CCMode mode);
+  // background. 'options' is a combination of CCOptions:
+  //
+  //   EARLY_ABORT: OCC and OCC-P check each read against the txn's start time
+  //     as it happens, and a background thread dooms running txns as soon as
+  //     a record they access is overwritten, instead of leaving them to fail
+  //     validation once they complete.
+  //
+  //   REPAIR: when an OCC txn fails validation, only the records that changed
+  //     are re-read, and the txn is repaired and revalidated right away
+  //     instead of being sent to the back of the request queue.
+  //
+  //   RETRY_QUEUE: OCC and OCC-P txns that fail validation back off for an
+  //     exponentially growing, randomized time, and are then retried ahead of
+  //     new requests, oldest first. A txn that fails MAX_RETRIES times runs
+  //     pessimistically, with no other writes going on, so it cannot starve.
+  //
+  //   SPLIT_HOT_KEYS: records that receive a burst of commutative updates are
+  //     split into per-core slices until they are next read (see 'Storage').
+  //     Applies to every mode that uses 'storage_' (all but SI, SSI, T/O and
+  //     MVTO).
+  //
+  //   PIN_THREADS: the scheduler thread is pinned to a physical core of its
+  //     own, and the workers are spread over the remaining cores, one per
+  //     core before a second hyperthread of any core is used (see
+  //     'CpuTopology'). On a single-core machine everything shares it.
+  //
+  // 'threads' is the number of threads in the pool, including the one that
+  // runs the scheduler (and, with EARLY_ABORT, the one that runs the
+  // invalidator). If 0, a default suited to txns that mostly wait (e.g. in
+  // 'Txn::Work()') is used.
+  explicit TxnProcessor(CCMode mode, int options = 0, int threads = 0);
 
   // The TxnProcessor's destructor stops all background threads and deallocates
   // all objects currently owned by the TxnProcessor, except for Txn objects.
   ~TxnProcessor();
 
   // Registers a new txn request to be executed by the TxnProcessor.
-  // Ownership of '*txn' is transfered to the TxnProcessor.
+  // Ownership of '*txn' is transfered to the TxnProcessor. The txn's key sets
+  // must pass 'Txn::CheckReadWriteSets()'.
   void NewTxnRequest(Txn* txn);
 
-  // Returns a pointer to the next COMMITTED or ABORTED Txn. The caller takes
-  // ownership of the returned Txn.
+  // Registers 'n' new txn requests at once, as if by 'NewTxnRequest()' on
+  // each of 'txns[0]' to 'txns[n - 1]' in turn, but taking the request lock
+  // and queueing them only once.
+  void NewTxnRequests(Txn** txns, int n);
+
+  // Like 'NewTxnRequest(txn)', but once the txn has committed or aborted,
+  // runs 'on_done' instead of queueing the txn for 'GetTxnResult()'.
+  // Ownership of '*txn' passes back to the client as 'on_done' starts.
+  //
+  // Note: 'on_done' runs on a TxnProcessor thread that is needed to finish
+  //       other txns, so it should return quickly. It may make new requests.
+  void NewTxnRequest(Txn* txn, const InlineTask& on_done);
+
+  // Like 'NewTxnRequest(txn)', but the result is delivered through '*future'
+  // (see 'TxnFuture') instead of 'GetTxnResult()'.
+  void NewTxnRequest(Txn* txn, TxnFuture* future);
+
+  // Returns a pointer to the next COMMITTED or ABORTED Txn, waiting for one
+  // if there is none yet. The caller takes ownership of the returned Txn.
   Txn* GetTxnResult();
 
+  // Like 'GetTxnResult()', but waits at most 'timeout' seconds (forever if
+  // 'timeout' is negative). Returns false if no txn finished in time.
+  bool GetTxnResult(Txn** txn, double timeout);
+
+  // Like 'GetTxnResult(txn, timeout)', but also takes any other results that
+  // are ready, up to 'max' in all. Returns the number of txns stored in
+  // 'txns', which is 0 only if none finished in time.
+  int GetTxnResults(Txn** txns, int max, double timeout = -1);
+
+  // Returns a new session (see 'TxnSession'). The TxnProcessor keeps
+  // ownership of it, and destroys it along with itself.
+  TxnSession* NewSession();
+
+  // Returns true iff the record with the specified key is currently split
+  // into per-core slices (see SPLIT_HOT_KEYS).
+  bool Split(Key key) { return storage_.Split(key); }
+
  private:
+  friend class TxnSession;
+
+  // Registers requests made through '*session'.
+  void NewSessionRequests(TxnSession* session, Txn** txns, int n);
+
+  // Pops the next request made through any session into '*txn' and returns
+  // true, or returns false if there is none. Sessions take turns.
+  bool NextSessionRequest(Txn** txn);
+
   // Main loop implementing all concurrency control/thread scheduling.
   void RunScheduler();
 
+  // Returns false once the scheduler loop should exit: either the processor
+  // is shutting down, or an ADAPTIVE mode switch has finished draining.
+  bool SchedulerActive();
+
+  // Returns true if the scheduler loop has nothing to do until another thread
+  // hands it something (a new request, a completed or validated txn, or a
+  // retired key) or a retry's backoff elapses.
+  bool SchedulerIdle();
+
+  // Puts the scheduler thread to sleep while it is idle: it spins briefly,
+  // then parks on 'wakeup_' until notified, until the next retry is due, or
+  // for at most IDLE_TIMEOUT (so that timed work such as ADAPTIVE's
+  // monitoring windows still happens, and shutdown is noticed).
+  void WaitForWork();
+
+  // Pops the next txn to start into '*txn' and returns true, or returns false
+  // if there is none. Retries that are due come first; new requests are only
+  // admitted while the scheduler is not draining.
+  bool Admit(Txn** txn);
+
+  // Returns a committed or aborted txn to the client: through its 'on_done_'
+  // callback if it has one, or else through 'txn_results_'.
+  void Finish(Txn* txn);
+
+  // Callback that marks '*future' ready.
+  void CompleteFuture(TxnFuture* future);
+
+  // Sends a txn that failed validation back to the request queue (or, with
+  // RETRY_QUEUE under OCC and OCC-P, to the retry queue).
+  void Restart(Txn* txn);
+
+  // Pops the oldest retry whose backoff has elapsed into '*txn' and returns
+  // true, or returns false if there is none.
+  bool NextRetry(Txn** txn);
+
+  // Executes a txn that has run out of retries on the scheduler thread and
+  // returns it to the client.
+  //
+  // Requires: no other thread is applying writes.
+  void RunFallback(Txn* txn);
+
   // Serial version of scheduler.
   void RunSerialScheduler();
 
@@ -70,14 +291,218 @@ class TxnProcessor {
   // OCC version of scheduler with parallel validation.
   void RunOCCParallelScheduler();
 
-  // Validate a transaction in parallel
-  void ValidateTxn(Txn* txn, set<Txn*>);
+  // Mostly-optimistic version of scheduler: locks keys that recently failed
+  // validation far more often than they committed, and validates the rest.
+  void RunMOCCScheduler();
+
+  // Returns true if 'key' is currently hot (MOCC only).
+  bool IsHot(const Key& key);
+
+  // Raises the temperature of 'key' after it caused a validation failure.
+  void HeatUp(const Key& key);
+
+  // Records that a txn which accessed 'key' optimistically has committed.
+  void CoolOff(const Key& key);
+
+  // Periodically halves all temperatures so that keys which stop causing
+  // aborts eventually go back to being accessed optimistically.
+  void CoolDown();
+
+  // Recent validation failures on a key, and commits of txns that accessed
+  // it optimistically since (MOCC only). 'hot' caches whether the former
+  // outweigh the latter enough for the key to be locked.
+  struct Temperature {
+    Temperature() : aborts(0), commits(0), hot(false) {}
+    int aborts;
+    int commits;
+    bool hot;
+  };
 
-  // Performs all reads required to execute the transaction, then executes the
-  // transaction logic.
+  // Recomputes whether 'temperature' is hot, keeping 'hot_keys_' up to date.
+  void UpdateHot(Temperature* temperature);
+
+  // Adaptive version of scheduler. Runs one of the SERIAL, LOCKING, OCC and
+  // P_OCC schedulers at a time, and switches between them at quiesce points
+  // based on the statistics gathered over each monitoring window.
+  void RunAdaptiveScheduler();
+
+  // Statistics gathered by the schedulers over one monitoring window.
+  struct WindowStats {
+    WindowStats()
+        : finished(0), restarted(0), lock_wait_time(0), execution_time(0),
+          validation_time(0) {}
+    int finished;            // Txns returned to the client.
+    int restarted;           // Txns that failed validation and were retried.
+    double lock_wait_time;   // Total time txns spent waiting for locks.
+    double execution_time;   // Total time locked txns spent executing.
+    double validation_time;  // Time the OCC scheduler thread spent validating.
+  };
+
+  // Closes the current monitoring window if it has run its length, and starts
+  // draining the active scheduler once a new mode has been preferred for
+  // HYSTERESIS consecutive windows.
+  void MonitorWindow();
+
+  // Returns the mode that best fits the statistics of the last window.
+  CCMode ChooseMode(const WindowStats& stats, double window);
+
+  // Snapshot isolation version of scheduler (SI and SSI). Each txn reads the
+  // multiversion snapshot as of its admission; at commit, write-write
+  // conflicts with txns that committed since then abort it (first committer
+  // wins). Under SSI, dangerous structures of rw-antidependencies abort it
+  // too.
+  void RunSnapshotScheduler();
+
+  // Executes the transaction logic, reading records from its snapshot in
+  // 'mv_storage_' on demand.
+  void ExecuteSnapshotTxn(Txn* txn);
+
+  // Returns true if committing '*txn' would violate SI (or, under SSI,
+  // serializability). Otherwise records any rw-antidependencies it forms
+  // (SSI only) and returns false.
+  bool SnapshotConflict(Txn* txn);
+
+  // Installs '*txn's writes as new versions at the next commit timestamp.
+  void CommitSnapshotTxn(Txn* txn);
+
+  // Drops SSI conflict records that no active txn can be concurrent with.
+  void PruneSSI();
+
+  // Timestamp ordering version of scheduler (T/O and MVTO). Each txn is
+  // ordered by the timestamp it is given when admitted. Its reads and
+  // writes are checked against 'to_storage_' while it runs, and an access
+  // that arrives too late dooms the txn at once rather than at validation.
+  void RunTimestampScheduler();
+
+  // Executes a T/O or MVTO txn's logic, then turns its commutative updates
+  // into ordinary reads and writes at its timestamp.
+  void RunTimestampTxn(Txn* txn);
+
+  // AccessHook methods. Under T/O and MVTO, read from and prewrite to
+  // 'to_storage_' at the txn's timestamp. Under OCC and OCC-P with early
+  // abort, access 'storage_', checking that the record has not been updated
+  // since the txn started. Either way, doom the txn if the access fails.
+  virtual bool OnRead(Txn* txn, const Key& key, Value* value);
+  virtual void OnWrite(Txn* txn, const Key& key);
+
+  // Bamboo version of scheduler. Like Locking B, except that a txn gives up
+  // its write lock on a key as soon as it retires the key. The next lock
+  // holders read the uncommitted value and may not commit before the txn
+  // that wrote it does; if that txn aborts, they are aborted too.
+  void RunBambooScheduler();
+
+  // AccessHook method (BAMBOO only). Passes '*txn's final value of 'key' on to
+  // the scheduler thread, which then releases the txn's lock on it.
+  virtual void OnRetire(Txn* txn, const Key& key);
+
+  // Publishes the retired values received from 'OnRetire()' and releases the
+  // corresponding locks.
+  void ProcessRetirements();
+
+  // Releases all locks '*txn' still holds, except commutative ones.
+  void ReleaseLocks(Txn* txn);
+
+  // Releases '*txn's commutative locks.
+  void ReleaseCommutativeLocks(Txn* txn);
+
+  // Reads '*txn's records, taking the newest uncommitted value of a key if
+  // there is one and recording a commit dependency on its writer, then starts
+  // the txn running.
+  void StartBambooTxn(Txn* txn);
+
+  // Withdraws '*txn's uncommitted values and aborts every txn that depends on
+  // them, directly or transitively. Dependents that have already completed
+  // are restarted right away; running ones once they complete.
+  void Cascade(Txn* txn);
+
+  // Commits (or aborts, according to its own vote) a completed txn whose
+  // dependencies have all committed, followed by any completed dependents
+  // that were only waiting for it.
+  void Resolve(Txn* txn);
+
+  // Repairs an OCC txn that failed validation because the records in 'stale'
+  // changed since it started. Returns true if the repaired txn is valid and
+  // its writes have been applied. Otherwise it is being re-executed against
+  // its up-to-date reads, and will be validated again once it completes.
+  bool RepairTxn(Txn* txn, const KeySet& stale);
+
+  // Replaces '*txn's cached read of 'key' with the record's current value.
+  void Reread(Txn* txn, const Key& key);
+
+  // Early abort (OCC and OCC-P only): routes '*txn's reads and writes through
+  // 'OnRead()'/'OnWrite()' and has 'invalidator_' watch it while it runs.
+  void Watch(Txn* txn);
+
+  // Stops watching '*txn' once it has finished running.
+  void Unwatch(Txn* txn);
+
+  // Background loop that has 'invalidator_' doom txns affected by newly
+  // applied writes (early abort only).
+  void RunInvalidator();
+
+  // Validate a transaction in parallel against the transactions that were
+  // already validating when it completed (its 'active_' snapshot).
+  void ValidateTxn(Txn* txn);
+
+  // Executes the transaction logic, reading records on demand.
   void ExecuteTxn(Txn* txn);
 
-  // Applies all writes performed by '*txn' to 'storage_'.
+  // Like 'ExecuteTxn()', but leaves the txn with the caller instead of handing
+  // it back to the scheduler thread.
+  void ReadAndRun(Txn* txn);
+
+  // Read-only fast path: takes a snapshot of the committed state on the
+  // scheduler thread (which applies every write in the modes that use it),
+  // then runs the txn's logic on a worker, reading the snapshot through
+  // 'snapshot_reads_', without any locking or validation.
+  //
+  // Requires: txn->ReadOnly(), and writes are only applied by the scheduler.
+  void StartReadOnlyTxn(Txn* txn);
+
+  // Releases a completed read-only txn's snapshot, commits/aborts it according
+  // to its own vote and returns it to the client.
+  void FinishReadOnlyTxn(Txn* txn);
+
+  // Executes the transaction logic on reads that have already been performed.
+  void RunTxn(Txn* txn);
+
+  // Executes the transaction logic again after 'RepairTxn()', keeping the
+  // reads it has already performed and reading any others on demand.
+  void RerunTxn(Txn* txn);
+
+  // Runs '*txn's logic. Unless the txn is being watched for early abort,
+  // records missing from 'reads_' are read through 'on_demand_' the first
+  // time the txn reads them.
+  void RunOnDemand(Txn* txn);
+
+  // AccessHook that reads records for txns whose reads concurrency control
+  // need not see as they happen: from 'storage_', or from the txn's snapshot
+  // in 'mv_storage_' under SI and SSI.
+  class OnDemandReads : public AccessHook {
+   public:
+    explicit OnDemandReads(TxnProcessor* processor) : processor_(processor) {}
+    virtual bool OnRead(Txn* txn, const Key& key, Value* value);
+    virtual void OnWrite(Txn* txn, const Key& key) {}
+
+   private:
+    TxnProcessor* processor_;
+  };
+
+  // AccessHook that reads records for read-only txns on the fast path, as of
+  // their snapshots: from 'storage_', or from 'snapshot_log_' if the record
+  // has been overwritten since.
+  class SnapshotReads : public AccessHook {
+   public:
+    explicit SnapshotReads(TxnProcessor* processor) : processor_(processor) {}
+    virtual bool OnRead(Txn* txn, const Key& key, Value* value);
+    virtual void OnWrite(Txn* txn, const Key& key) {}
+
+   private:
+    TxnProcessor* processor_;
+  };
+
+  // Applies all writes performed by '*txn' to 'storage_', first logging what
+  // they overwrite in 'snapshot_log_' while read-only txns hold snapshots.
   //
   // Requires: txn->Status() is COMPLETED_C.
   void ApplyWrites(Txn* txn);
@@ -85,14 +510,21 @@ class TxnProcessor {
   // Concurrency control mechanism the TxnProcessor is currently using.
   CCMode mode_;
 
+  // Combination of CCOptions in effect (see constructor).
+  int options_;
+
   // Thread pool managing all threads used by TxnProcessor.
   StaticThreadPool tp_;
 
+  // CPU the scheduler thread pins itself to, or -1 (see PIN_THREADS).
+  int scheduler_cpu_;
+
   // Data storage used for all modes.
   Storage storage_;
 
-  // Next valid unique_id, and a mutex to guard incoming txn requests.
-  int next_unique_id_;
+  // Next valid unique_id, and a mutex that keeps 'txn_requests_' in id
+  // order. Requests made through sessions take ids without the mutex.
+  std::atomic<uint64> next_unique_id_;
   Mutex mutex_;
 
   // Queue of incoming transaction requests.
@@ -105,20 +537,129 @@ class TxnProcessor {
   deque<Txn*> ready_txns_;
 
   // Queue of completed (but not yet committed/aborted) transactions.
-  AtomicQueue<Txn*> completed_txns_;
+  FanInQueue<Txn*> completed_txns_;
 
-  // Active set
-  set<Txn*> active_set_;
+  // Transactions currently being validated (OCC-P only). Each validator gets
+  // a shared, immutable snapshot instead of its own copy.
+  ActiveSet active_set_;
+
+  // OCC-P only: the order in which each running validator started, and
+  // validated txns waiting for the validators that started before them to
+  // finish (see 'RunOCCParallelScheduler()').
+  uint64 next_ticket_;
+  unordered_map<Txn*, uint64> tickets_;
+  set<uint64> validating_;
+  deque<std::pair<uint64, Txn*> > validated_;
 
   // Map of validated transactions to validity
-  AtomicQueue<std::pair<Txn*, bool> > validated_txns_;
+  FanInQueue<std::pair<Txn*, bool> > validated_txns_;
 
   // Queue of transaction results (already committed or aborted) to be returned
-  // to client.
+  // to client, and notified after each push so that 'GetTxnResult()' can
+  // sleep until there is one.
   AtomicQueue<Txn*> txn_results_;
+  EventCount results_ready_;
+
+  // Notified whenever a TxnFuture becomes ready.
+  EventCount futures_ready_;
 
-  // Lock Manager used for LOCKING concurrency implementations.
+  // Newest session (the others follow through 'TxnSession::next_'), and the
+  // session 'NextSessionRequest()' looks at first (NULL for the newest).
+  std::atomic<TxnSession*> sessions_;
+  TxnSession* next_session_;
+
+  // Notified after every push onto a queue the scheduler reads from
+  // ('txn_requests_', 'completed_txns_', 'validated_txns_' and 'retired_'),
+  // so that an idle scheduler can sleep instead of polling them.
+  EventCount wakeup_;
+
+  // Lock Manager used for LOCKING concurrency implementations (and for hot
+  // keys in MOCC).
   LockManager* lm_;
+
+  // Temperature of each key that has recently failed validation (MOCC only),
+  // the number of those keys that are hot, and the last time temperatures
+  // were decayed.
+  unordered_map<Key, Temperature> temperature_;
+  int hot_keys_;
+  double last_cooldown_;
+
+  // Number of txns admitted by the scheduler and not yet returned to the
+  // client or sent back to the request queue.
+  int in_flight_;
+
+  // Set while the scheduler stops admitting txns ahead of a mode switch.
+  bool draining_;
+
+  // ADAPTIVE only: the mode currently running, when it started, the mode it
+  // is about to switch to (and for how many windows that has been preferred),
+  // and the last throughput measured under OCC.
+  CCMode active_mode_;
+  double mode_start_;
+  CCMode candidate_;
+  int candidate_windows_;
+  double occ_throughput_;
+
+  // Statistics for the current monitoring window.
+  WindowStats stats_;
+  double window_start_;
+
+  // Multiversion storage (SI and SSI only), and logical commit clock (SI and
+  // SSI, and read-only snapshots in the single-version modes).
+  MVStorage mv_storage_;
+  uint64 last_commit_ts_;
+
+  // Snapshot timestamps of all txns currently in flight (SI and SSI) or of
+  // read-only txns on the fast path, or timestamps of the txns themselves
+  // (T/O and MVTO). The oldest one bounds which versions, overwritten values
+  // and SSI records must be kept.
+  multiset<uint64> active_snapshots_;
+
+  // Values overwritten in 'storage_' that read-only snapshots may still need.
+  SnapshotLog snapshot_log_;
+
+  // SSI only: the txns that have read each key (SIREAD markers), and the
+  // committed txns that have written each key, for as long as they may still
+  // be concurrent with an active txn.
+  unordered_map<Key, vector<shared_ptr<SSIInfo> > > readers_;
+  unordered_map<Key, vector<shared_ptr<SSIInfo> > > writers_;
+  double last_prune_;
+
+  // Records with read/write timestamps, and the timestamp the next admitted
+  // txn gets (T/O and MVTO only).
+  TOStorage to_storage_;
+  uint64 next_ts_;
+
+  // Tracks running optimistic txns for early abort.
+  Invalidator invalidator_;
+
+  // RETRY_QUEUE only: txns backing off (keyed by when they may retry), txns
+  // ready to retry (keyed by when they were first requested), and txns that
+  // ran out of retries. All of them still count as in flight.
+  multimap<double, Txn*> backoff_;
+  multimap<double, Txn*> retries_;
+  deque<Txn*> fallback_;
+
+  // Commit dependencies of a txn (BAMBOO only).
+  struct BambooInfo {
+    BambooInfo() : completed(false) {}
+    set<Txn*> depends_on;  // Uncommitted txns whose writes it has seen.
+    set<Txn*> dependents;  // Txns that have seen its writes.
+    KeySet published;      // Keys whose retired values are in 'dirty_'.
+    bool completed;        // Done running, possibly waiting on 'depends_on'.
+  };
+  unordered_map<Txn*, BambooInfo> bamboo_;
+
+  // BAMBOO only: retired values on their way from workers to the scheduler,
+  // and the uncommitted values of each key, oldest first.
+  FanInQueue<std::pair<Txn*, std::pair<Key, Value> > > retired_;
+  unordered_map<Key, deque<std::pair<Txn*, Value> > > dirty_;
+
+  // Reads records on demand for txns that have no other AccessHook.
+  OnDemandReads on_demand_;
+
+  // Reads records for read-only txns on the fast path.
+  SnapshotReads snapshot_reads_;
 };
 
 #endif  // _TXN_PROCESSOR_H_
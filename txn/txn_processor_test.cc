@@ -3,6 +3,9 @@
 #include "txn/txn_processor.h"
 #include "txn/txn.h"
 
+#include <string.h>
+#include <sys/resource.h>
+
 #include <vector>
 #include <string>
 
@@ -26,9 +29,10 @@ class BankTxn : public Txn {
     Value result;
     Read(1, &result);
     Write(1, result + 1);
+    Retire(1);
 
     // Wait a random amount of time (averaging time_) before committing.
-    Sleep(0.9 * time_ + RandomDouble(time_ * 0.2));
+    Work(0.9 * time_ + RandomDouble(time_ * 0.2));
     COMMIT;
   }
 
@@ -60,7 +64,7 @@ class Shopping : public Txn {
     }
 
     // Wait a random amount of time (averaging time_) before committing.
-    Sleep(0.9 * time_ + RandomDouble(time_ * 0.2));
+    Work(0.9 * time_ + RandomDouble(time_ * 0.2));
     COMMIT;
   }
 
@@ -180,220 +184,2081 @@ TEST(ShoppingTest) {
   END;
 }
 
+TEST(MOCCBank) {
+  TxnProcessor p(MOCC);
+  Txn* t;
 
-// Returns a human-readable string naming of the providing mode.
-string ModeToString(CCMode mode) {
-  switch (mode) {
-    case SERIAL:                 return " Serial   ";
-    case LOCKING_EXCLUSIVE_ONLY: return " Locking A";
-    case LOCKING:                return " Locking B";
-    case OCC:                    return " OCC      ";
-    case P_OCC:                  return " OCC-P    ";
-    default:                     return "INVALID MODE";
-  }
+  map<Key, Value> m = {{1, 0}};
+
+  p.NewTxnRequest(new Put(m));
+  delete p.GetTxnResult();
+
+  // Enough conflicting increments on key 1 to make it hot.
+  for (int i = 0; i < 50; i++)
+    p.NewTxnRequest(new BankTxn(0.0001));
+  for (int i = 0; i < 50; i++)
+    delete p.GetTxnResult();
+
+  map<Key, Value> ok = {{1, 50}};
+  p.NewTxnRequest(new Expect(ok));  // Should commit
+  t = p.GetTxnResult();
+  EXPECT_EQ(COMMITTED, t->Status());
+  delete t;
+
+  END;
 }
 
-class LoadGen {
+// Works for a while before reading 'key', and commits iff it has the expected
+// value.
+class LateRead : public Txn {
  public:
-  virtual ~LoadGen() {}
-  virtual Txn* NewTxn() = 0;
-};
+  LateRead(Key key, Value expected, double time)
+      : key_(key), expected_(expected), time_(time) {
+    readset_ = {key};
+  }
 
-class RMWLoadGen : public LoadGen {
- public:
-  RMWLoadGen(int dbsize, int rsetsize, int wsetsize, double wait_time)
-    : dbsize_(dbsize),
-      rsetsize_(rsetsize),
-      wsetsize_(wsetsize),
-      wait_time_(wait_time) {
+  LateRead* clone() const {             // Virtual constructor (copying)
+    LateRead* clone = new LateRead(key_, expected_, time_);
+    this->CopyTxnInternals(clone);
+    return clone;
   }
 
-  virtual Txn* NewTxn() {
-    return new RMW(dbsize_, rsetsize_, wsetsize_, wait_time_);
+  void Run() {
+    Work(time_);
+    Value result;
+    if (!Read(key_, &result) || result != expected_)
+      ABORT;
+    COMMIT;
   }
 
  private:
-  int dbsize_;
-  int rsetsize_;
-  int wsetsize_;
-  double wait_time_;
+  Key key_;
+  Value expected_;
+  double time_;
 };
 
-class RMWLoadGen2 : public LoadGen {
+TEST(ReadOnlyFastPath) {
+  TxnProcessor p(LOCKING);
+  Txn* t;
+
+  map<Key, Value> m = {{1, 0}};
+
+  p.NewTxnRequest(new Put(m));
+  delete p.GetTxnResult();
+
+  // The writer holds an exclusive lock on key 1 for half a second. A read-only
+  // txn doesn't wait for it, and sees the last committed value.
+  p.NewTxnRequest(new BankTxn(0.5));
+  map<Key, Value> before = {{1, 0}};
+  p.NewTxnRequest(new Expect(before));
+
+  t = p.GetTxnResult();
+  EXPECT_EQ(COMMITTED, t->Status());
+  EXPECT_TRUE(t->ReadOnly());
+  delete t;
+
+  t = p.GetTxnResult();
+  EXPECT_EQ(COMMITTED, t->Status());
+  EXPECT_FALSE(t->ReadOnly());
+  delete t;
+
+  // A read-only txn reads on its worker, yet still sees its snapshot after a
+  // later writer commits over it.
+  CCMode modes[] = {LOCKING, OCC};
+  for (int i = 0; i < 2; i++) {
+    TxnProcessor q(modes[i]);
+    q.NewTxnRequest(new Put(m));
+    delete q.GetTxnResult();
+
+    map<Key, Value> update = {{1, 5}};
+    q.NewTxnRequest(new LateRead(1, 0, 0.3));
+    q.NewTxnRequest(new Put(update));
+
+    t = q.GetTxnResult();
+    EXPECT_FALSE(t->ReadOnly());
+    delete t;
+
+    t = q.GetTxnResult();
+    EXPECT_EQ(COMMITTED, t->Status());
+    EXPECT_TRUE(t->ReadOnly());
+    delete t;
+  }
+
+  END;
+}
+
+// Takes one of two on-call doctors off call, as long as the other stays on
+// call. Two of these running concurrently on different doctors can leave no
+// one on call under plain snapshot isolation (write skew).
+class GoOffCall : public Txn {
  public:
-  RMWLoadGen2(int dbsize, int rsetsize, int wsetsize, double wait_time)
-    : dbsize_(dbsize),
-      rsetsize_(rsetsize),
-      wsetsize_(wsetsize),
-      wait_time_(wait_time) {
+  GoOffCall(Key self, Key other, double time = 0)
+      : self_(self), other_(other), time_(time) {
+    readset_ = {other};
+    writeset_ = {self};
   }
 
-  virtual Txn* NewTxn() {
-    // 10% of transactions are READ only transactions and run for the full
-    // transaction duration. The rest are very fast (< 0.1ms), high-contention
-    // (65%+) updates.
-    if (rand() % 100 < 10)
-      return new RMW(dbsize_, rsetsize_, 0, wait_time_);
-    else
-      return new RMW(dbsize_, 0, wsetsize_, 0);
+  GoOffCall* clone() const {             // Virtual constructor (copying)
+    GoOffCall* clone = new GoOffCall(self_, other_, time_);
+    this->CopyTxnInternals(clone);
+    return clone;
+  }
+
+  void Run() {
+    Value self = 0;
+    Value other = 0;
+    Read(self_, &self);
+    Read(other_, &other);
+
+    // Give a concurrent txn time to take the same snapshot.
+    Sleep(time_);
+
+    if (self + other >= 2)
+      Write(self_, self - 1);
+    COMMIT;
   }
 
  private:
-  int dbsize_;
-  int rsetsize_;
-  int wsetsize_;
-  double wait_time_;
+  Key self_;
+  Key other_;
+  double time_;
 };
 
-void Benchmark(const vector<LoadGen*>& lg) {
-  // Number of transaction requests that can be active at any given time.
-  int active_txns = 100;
-  deque<Txn*> doneTxns;
+TEST(SnapshotWriteSkew) {
+  CCMode modes[] = {SI, SSI};
+  for (int i = 0; i < 2; i++) {
+    TxnProcessor p(modes[i]);
+    Txn* t;
+
+    map<Key, Value> m = {{1, 1}, {2, 1}};
+    p.NewTxnRequest(new Put(m));
+    delete p.GetTxnResult();
+
+    p.NewTxnRequest(new GoOffCall(1, 2, 0.1));
+    p.NewTxnRequest(new GoOffCall(2, 1, 0.1));
+    delete p.GetTxnResult();
+    delete p.GetTxnResult();
+
+    // SI lets both txns commit; SSI restarts one of them, which then sees
+    // that the other doctor has already gone off call.
+    map<Key, Value> skewed = {{1, 0}, {2, 0}};
+    p.NewTxnRequest(new Expect(skewed));
+    TxnStatus expected = (modes[i] == SI) ? COMMITTED : ABORTED;
+    t = p.GetTxnResult();
+    EXPECT_EQ(expected, t->Status());
+    delete t;
+  }
 
-  // Set initial db state.
-  map<Key, Value> db_init;
-  for (int i = 0; i < 10000; i++)
-    db_init[i] = 0;
+  END;
+}
 
-  // For each MODE...
-  for (CCMode mode = SERIAL;
-      mode <= P_OCC;
-      mode = static_cast<CCMode>(mode+1)) {
-  // CCMode mode = P_OCC;
-  // if (1) {
-    // Print out mode name.
-    cout << ModeToString(mode) << flush;
+TEST(AdaptiveModeSwitch) {
+  TxnProcessor p(ADAPTIVE);
+  Txn* t;
 
-    // For each experiment...
-    for (uint32 exp = 0; exp < lg.size(); exp++) {
-      int txn_count = 0;
+  map<Key, Value> m = {{1, 0}};
 
-      // Create TxnProcessor in next mode.
-      TxnProcessor* p = new TxnProcessor(mode);
+  p.NewTxnRequest(new Put(m));
+  delete p.GetTxnResult();
 
-      // Initialize data with initial db state.
-      Put init_txn(db_init);
-      p->NewTxnRequest(&init_txn);
-      p->GetTxnResult();
+  // Hammer a single key for long enough that the processor leaves OCC, and
+  // check that no increments are lost across the switch(es).
+  int count = 0;
+  double start = GetTime();
+  for (int i = 0; i < 20; i++)
+    p.NewTxnRequest(new BankTxn(0.0001));
+  while (GetTime() < start + 1) {
+    delete p.GetTxnResult();
+    count++;
+    p.NewTxnRequest(new BankTxn(0.0001));
+  }
+  for (int i = 0; i < 20; i++) {
+    delete p.GetTxnResult();
+    count++;
+  }
 
-      // Record start time.
-      double start = GetTime();
+  map<Key, Value> ok = {{1, static_cast<Value>(count)}};
+  p.NewTxnRequest(new Expect(ok));  // Should commit
+  t = p.GetTxnResult();
+  EXPECT_EQ(COMMITTED, t->Status());
+  delete t;
 
-      // Start specified number of txns running.
-      for (int i = 0; i < active_txns; i++)
-        p->NewTxnRequest(lg[exp]->NewTxn());
+  END;
+}
 
-      // Keep 100 active txns at all times for the first full second.
-      while (GetTime() < start + 1) {
-        doneTxns.push_back(p->GetTxnResult());
-        txn_count++;
-        p->NewTxnRequest(lg[exp]->NewTxn());
-      }
+// Works for a while before blindly writing 'value' to 'key'.
+class LateWrite : public Txn {
+ public:
+  LateWrite(Key key, Value value, double time)
+      : key_(key), value_(value), time_(time) {
+    writeset_ = {key};
+  }
 
-      // Wait for all of them to finish.
-      for (int i = 0; i < active_txns; i++) {
-        doneTxns.push_back(p->GetTxnResult());
-        txn_count++;
-      }
+  LateWrite* clone() const {             // Virtual constructor (copying)
+    LateWrite* clone = new LateWrite(key_, value_, time_);
+    this->CopyTxnInternals(clone);
+    return clone;
+  }
 
-      // Record end time.
-      double end = GetTime();
+  void Run() {
+    Work(time_);
+    Write(key_, value_);
+    COMMIT;
+  }
 
-      // Print throughput
-      cout << "\t" << (txn_count / (end-start)) << "\t" << flush;
+ private:
+  Key key_;
+  Value value_;
+  double time_;
+};
 
-      // Delete TxnProcessor and completed transactions.
-      doneTxns.clear();
-      delete p;
-    }
+TEST(TimestampOrdering) {
+  CCMode modes[] = {TO, MVTO};
+  for (int i = 0; i < 2; i++) {
+    TxnProcessor p(modes[i]);
+    Txn* t;
+
+    map<Key, Value> m = {{1, 0}};
+    p.NewTxnRequest(new Put(m));
+    delete p.GetTxnResult();
+
+    // A younger txn overwrites key 1 before an older one gets around to
+    // reading it. T/O restarts the reader, which then sees the new value;
+    // MVTO serves it the version that was current at its timestamp.
+    map<Key, Value> update = {{1, 1}};
+    p.NewTxnRequest(new LateRead(1, 0, 0.5));
+    p.NewTxnRequest(new Put(update));
+
+    t = p.GetTxnResult();
+    EXPECT_EQ(COMMITTED, t->Status());
+    delete t;
+
+    TxnStatus expected = (modes[i] == TO) ? ABORTED : COMMITTED;
+    int restarts = (modes[i] == TO) ? 1 : 0;
+    t = p.GetTxnResult();
+    EXPECT_EQ(expected, t->Status());
+    EXPECT_EQ(restarts, t->Restarts());
+    delete t;
+
+    // Conflicting increments are neither lost nor applied twice.
+    for (int j = 0; j < 50; j++)
+      p.NewTxnRequest(new BankTxn(0.0001));
+    for (int j = 0; j < 50; j++)
+      delete p.GetTxnResult();
+
+    map<Key, Value> ok = {{1, 51}};
+    p.NewTxnRequest(new Expect(ok));  // Should commit
+    t = p.GetTxnResult();
+    EXPECT_EQ(COMMITTED, t->Status());
+    delete t;
+  }
 
-    cout << endl;
+  END;
+}
+
+TEST(LateWriteAfterYoungerCommit) {
+  CCMode modes[] = {TO, MVTO};
+  for (int i = 0; i < 2; i++) {
+    TxnProcessor p(modes[i]);
+    Txn* t;
+
+    // A younger txn commits a write to key 1 before an older one writes it.
+    // T/O has already discarded the version the older write would follow, so
+    // it restarts the writer, whose write then lands last. MVTO slots the
+    // older write in below the younger one.
+    map<Key, Value> update = {{1, 1}};
+    p.NewTxnRequest(new LateWrite(1, 2, 0.3));
+    p.NewTxnRequest(new Put(update));
+
+    t = p.GetTxnResult();
+    EXPECT_EQ(COMMITTED, t->Status());
+    delete t;
+
+    int restarts = (modes[i] == TO) ? 1 : 0;
+    t = p.GetTxnResult();
+    EXPECT_EQ(COMMITTED, t->Status());
+    EXPECT_EQ(restarts, t->Restarts());
+    delete t;
+
+    map<Key, Value> last = {{1, (modes[i] == TO) ? 2 : 1}};
+    p.NewTxnRequest(new Expect(last));  // Should commit
+    t = p.GetTxnResult();
+    EXPECT_EQ(COMMITTED, t->Status());
+    delete t;
   }
+
+  END;
 }
 
-int main(int argc, char** argv) {
-  vector<LoadGen *> lg;
+TEST(EarlyAbort) {
+  CCMode modes[] = {OCC, P_OCC};
+  for (int i = 0; i < 2; i++) {
+    TxnProcessor p(modes[i], EARLY_ABORT);
+    Txn* t;
+
+    map<Key, Value> m = {{1, 0}};
+    p.NewTxnRequest(new Put(m));
+    delete p.GetTxnResult();
+
+    // The quick increment commits while the slow one is still working on its
+    // stale read. The slow one is doomed right away, instead of only failing
+    // validation a second later.
+    p.NewTxnRequest(new BankTxn(1));
+    p.NewTxnRequest(new BankTxn(0.0001));
+
+    t = p.GetTxnResult();
+    EXPECT_EQ(COMMITTED, t->Status());
+    EXPECT_EQ(0, t->Restarts());
+    delete t;
+
+    t = p.GetTxnResult();
+    EXPECT_EQ(COMMITTED, t->Status());
+    EXPECT_EQ(1, t->Restarts());
+    EXPECT_TRUE(t->WastedTime() < 0.5);
+    delete t;
+
+    map<Key, Value> ok = {{1, 2}};
+    p.NewTxnRequest(new Expect(ok));  // Should commit
+    t = p.GetTxnResult();
+    EXPECT_EQ(COMMITTED, t->Status());
+    delete t;
+  }
 
-  NoopTest();
-  PutTest();
-  BasicBank();
-  ShoppingTest();
+  END;
+}
 
-  cout << "\t\t\t    Average Transaction Duration" << endl;
-  cout << "\t\t0.1ms\t\t1ms\t\t10ms\t\t100ms";
-  cout << endl;
+TEST(Repair) {
+  TxnProcessor p(OCC, REPAIR);
+  Txn* t;
 
-  cout << "Read only" << endl;
-  lg.push_back(new RMWLoadGen(10000, 10, 0, 0.0001));
-  lg.push_back(new RMWLoadGen(10000, 10, 0, 0.001));
-  lg.push_back(new RMWLoadGen(10000, 10, 0, 0.01));
-  lg.push_back(new RMWLoadGen(10000, 10, 0, 0.1));
+  map<Key, Value> m = {{1, 0}};
+  p.NewTxnRequest(new Put(m));
+  delete p.GetTxnResult();
 
-  Benchmark(lg);
+  // The slow increment fails validation because of the quick one. It is
+  // repaired in place by redoing just its increment, so none of its work is
+  // thrown away.
+  set<Key> keys = {1};
+  p.NewTxnRequest(new RMW(keys, 0.5));
+  p.NewTxnRequest(new RMW(keys, 0.0001));
 
-  for (uint32 i = 0; i < lg.size(); i++)
-    delete lg[i];
-  lg.clear();
+  t = p.GetTxnResult();
+  EXPECT_EQ(COMMITTED, t->Status());
+  EXPECT_EQ(0, t->Restarts());
+  delete t;
 
-  cout << "1% contention" << endl;
-  lg.push_back(new RMWLoadGen(10000, 10, 10, 0.0001));
-  lg.push_back(new RMWLoadGen(10000, 10, 10, 0.001));
-  lg.push_back(new RMWLoadGen(10000, 10, 10, 0.01));
-  lg.push_back(new RMWLoadGen(10000, 10, 10, 0.1));
+  t = p.GetTxnResult();
+  EXPECT_EQ(COMMITTED, t->Status());
+  EXPECT_EQ(1, t->Restarts());
+  EXPECT_EQ(0, t->WastedTime());
+  delete t;
 
-  Benchmark(lg);
+  // Txns that cannot repair themselves are re-run against their cached reads.
+  for (int i = 0; i < 50; i++)
+    p.NewTxnRequest(new BankTxn(0.0001));
+  for (int i = 0; i < 50; i++)
+    delete p.GetTxnResult();
 
-  for (uint32 i = 0; i < lg.size(); i++)
-    delete lg[i];
-  lg.clear();
+  map<Key, Value> ok = {{1, 52}};
+  p.NewTxnRequest(new Expect(ok));  // Should commit
+  t = p.GetTxnResult();
+  EXPECT_EQ(COMMITTED, t->Status());
+  delete t;
 
-  cout << "10% contention" << endl;
-  lg.push_back(new RMWLoadGen(1000, 10, 10, 0.0001));
-  lg.push_back(new RMWLoadGen(1000, 10, 10, 0.001));
-  lg.push_back(new RMWLoadGen(1000, 10, 10, 0.01));
-  lg.push_back(new RMWLoadGen(1000, 10, 10, 0.1));
+  END;
+}
 
-  Benchmark(lg);
+TEST(RetryQueue) {
+  CCMode modes[] = {OCC, P_OCC};
+  for (int i = 0; i < 2; i++) {
+    TxnProcessor p(modes[i], RETRY_QUEUE);
+    Txn* t;
+
+    map<Key, Value> m = {{1, 0}};
+    p.NewTxnRequest(new Put(m));
+    delete p.GetTxnResult();
+
+    // Every txn conflicts with every other one. None of them is restarted
+    // more than MAX_RETRIES (5) times before falling back to pessimistic
+    // execution, which always succeeds.
+    for (int j = 0; j < 100; j++)
+      p.NewTxnRequest(new BankTxn(0.0001));
+    for (int j = 0; j < 100; j++) {
+      t = p.GetTxnResult();
+      EXPECT_EQ(COMMITTED, t->Status());
+      EXPECT_TRUE(t->Restarts() <= 6);
+      delete t;
+    }
 
-  for (uint32 i = 0; i < lg.size(); i++)
-    delete lg[i];
-  lg.clear();
+    map<Key, Value> ok = {{1, 100}};
+    p.NewTxnRequest(new Expect(ok));  // Should commit
+    t = p.GetTxnResult();
+    EXPECT_EQ(COMMITTED, t->Status());
+    delete t;
+  }
 
-  cout << "65% contention" << endl;
-  lg.push_back(new RMWLoadGen(100, 10, 10, 0.0001));
-  lg.push_back(new RMWLoadGen(100, 10, 10, 0.001));
-  lg.push_back(new RMWLoadGen(100, 10, 10, 0.01));
-  lg.push_back(new RMWLoadGen(100, 10, 10, 0.1));
+  END;
+}
 
-  Benchmark(lg);
+// Overwrites 'key', retires it, and aborts 'time' seconds later.
+class RetireThenAbort : public Txn {
+ public:
+  RetireThenAbort(Key key, Value value, double time)
+      : key_(key), value_(value), time_(time) {
+    writeset_ = {key};
+  }
 
-  for (uint32 i = 0; i < lg.size(); i++)
-    delete lg[i];
-  lg.clear();
+  RetireThenAbort* clone() const {      // Virtual constructor (copying)
+    RetireThenAbort* clone = new RetireThenAbort(key_, value_, time_);
+    this->CopyTxnInternals(clone);
+    return clone;
+  }
 
-  cout << "100% contention" << endl;
-  lg.push_back(new RMWLoadGen(10, 0, 10, 0.0001));
-  lg.push_back(new RMWLoadGen(10, 0, 10, 0.001));
-  lg.push_back(new RMWLoadGen(10, 0, 10, 0.01));
-  lg.push_back(new RMWLoadGen(10, 0, 10, 0.1));
+  void Run() {
+    Write(key_, value_);
+    Retire(key_);
+    Work(time_);
+    ABORT;
+  }
 
+ private:
+  Key key_;
+  Value value_;
+  double time_;
+};
 
-  Benchmark(lg);
+TEST(Bamboo) {
+  TxnProcessor p(BAMBOO);
+  Txn* t;
 
-  for (uint32 i = 0; i < lg.size(); i++)
-    delete lg[i];
-  lg.clear();
+  map<Key, Value> m = {{1, 0}};
+  p.NewTxnRequest(new Put(m));
+  delete p.GetTxnResult();
 
-  cout << "High contention mixed read/write" << endl;
-  lg.push_back(new RMWLoadGen2(100, 20, 10, 0.0001));
-  lg.push_back(new RMWLoadGen2(100, 20, 10, 0.001));
-  lg.push_back(new RMWLoadGen2(100, 20, 10, 0.01));
-  lg.push_back(new RMWLoadGen2(100, 20, 10, 0.1));
+  // Conflicting increments are neither lost nor applied twice.
+  for (int j = 0; j < 50; j++)
+    p.NewTxnRequest(new BankTxn(0.0001));
+  for (int j = 0; j < 50; j++) {
+    t = p.GetTxnResult();
+    EXPECT_EQ(COMMITTED, t->Status());
+    delete t;
+  }
 
-  Benchmark(lg);
+  // The writer retires key 1 long before it aborts, so the BankTxn reads the
+  // uncommitted value 100 instead of waiting for the lock. Once the writer
+  // aborts, so does the BankTxn, which then reruns against the committed
+  // value.
+  p.NewTxnRequest(new RetireThenAbort(1, 100, 0.5));
+  p.NewTxnRequest(new BankTxn(0));
 
-  for (uint32 i = 0; i < lg.size(); i++)
-    delete lg[i];
-  lg.clear();
+  t = p.GetTxnResult();
+  EXPECT_EQ(ABORTED, t->Status());
+  delete t;
+
+  t = p.GetTxnResult();
+  EXPECT_EQ(COMMITTED, t->Status());
+  EXPECT_EQ(1, t->Restarts());
+  delete t;
+
+  map<Key, Value> ok = {{1, 51}};
+  p.NewTxnRequest(new Expect(ok));  // Should commit
+  t = p.GetTxnResult();
+  EXPECT_EQ(COMMITTED, t->Status());
+  delete t;
+
+  END;
+}
+
+// Adds one to key 1, and lowers key 2 and raises key 3 to 'value', all with
+// commutative updates.
+class Tally : public Txn {
+ public:
+  Tally(Value value, double time) : value_(value), time_(time) {
+    deltaset_ = {1, 2, 3};
+  }
+
+  Tally* clone() const {                // Virtual constructor (copying)
+    Tally* clone = new Tally(value_, time_);
+    this->CopyTxnInternals(clone);
+    return clone;
+  }
+
+  void Run() {
+    Add(1, 1);
+    Min(2, value_);
+    Max(3, value_);
+    Work(time_);
+    COMMIT;
+  }
+
+ private:
+  Value value_;
+  double time_;
+};
+
+TEST(CommutativeUpdates) {
+  for (CCMode mode = SERIAL;
+       mode <= BAMBOO;
+       mode = static_cast<CCMode>(mode+1)) {
+    TxnProcessor p(mode);
+    Txn* t;
+
+    map<Key, Value> m = {{1, 0}, {2, 100}, {3, 0}};
+    p.NewTxnRequest(new Put(m));
+    delete p.GetTxnResult();
+
+    // Concurrent updates all touch the same keys, but never conflict, except
+    // under T/O and MVTO, which apply them as ordinary read-modify-writes.
+    int restarts = 0;
+    for (int j = 0; j < 20; j++)
+      p.NewTxnRequest(new Tally(j, 0.01));
+    for (int j = 0; j < 20; j++) {
+      t = p.GetTxnResult();
+      EXPECT_EQ(COMMITTED, t->Status());
+      restarts += t->Restarts();
+      delete t;
+    }
+    if (mode != TO && mode != MVTO)
+      EXPECT_EQ(0, restarts);
+
+    map<Key, Value> ok = {{1, 20}, {2, 0}, {3, 19}};
+    p.NewTxnRequest(new Expect(ok));  // Should commit
+    t = p.GetTxnResult();
+    EXPECT_EQ(COMMITTED, t->Status());
+    delete t;
+  }
+
+  END;
+}
+
+TEST(SplitHotKeys) {
+  CCMode modes[] = {LOCKING, OCC, P_OCC};
+  for (int i = 0; i < 3; i++) {
+    TxnProcessor p(modes[i], SPLIT_HOT_KEYS);
+    Txn* t;
+
+    map<Key, Value> m = {{1, 0}};
+    p.NewTxnRequest(new Put(m));
+    delete p.GetTxnResult();
+
+    // A burst of increments splits key 1. Reading it joins it again, and
+    // sees every increment applied while it was split.
+    set<Key> none, hot = {1};
+    for (int round = 1; round <= 2; round++) {
+      EXPECT_FALSE(p.Split(1));
+      for (int j = 0; j < 100; j++)
+        p.NewTxnRequest(new Increment(none, hot));
+      for (int j = 0; j < 100; j++) {
+        t = p.GetTxnResult();
+        EXPECT_EQ(COMMITTED, t->Status());
+        delete t;
+      }
+      EXPECT_TRUE(p.Split(1));
+
+      map<Key, Value> ok = {{1, 100 * round}};
+      p.NewTxnRequest(new Expect(ok));  // Should commit
+      t = p.GetTxnResult();
+      EXPECT_EQ(COMMITTED, t->Status());
+      delete t;
+    }
+    EXPECT_FALSE(p.Split(1));
+  }
+
+  END;
+}
+
+// Declares every key in 'writeset' (as a txn must when it cannot tell in
+// advance which records it will need), but only increments 'key'. Aborts if
+// 'key' does not exist.
+class Pick : public Txn {
+ public:
+  Pick(const KeySet& writeset, Key key, double time = 0)
+      : key_(key), time_(time) {
+    writeset_ = writeset;
+  }
+
+  Pick* clone() const {                 // Virtual constructor (copying)
+    Pick* clone = new Pick(writeset_, key_, time_);
+    this->CopyTxnInternals(clone);
+    return clone;
+  }
+
+  void Run() {
+    Value result;
+    if (!Read(key_, &result))
+      ABORT;
+    Write(key_, result + 1);
+    Retire(key_);
+
+    // Wait a random amount of time (averaging time_) before committing.
+    Work(0.9 * time_ + RandomDouble(time_ * 0.2));
+    COMMIT;
+  }
+
+ private:
+  Key key_;
+  double time_;
+};
+
+TEST(OnDemandReads) {
+  for (CCMode mode = SERIAL;
+       mode <= BAMBOO;
+       mode = static_cast<CCMode>(mode+1)) {
+    TxnProcessor p(mode);
+    Txn* t;
+
+    set<Key> declared;
+    map<Key, Value> m;
+    for (Key key = 0; key < 100; key++) {
+      declared.insert(key);
+      m[key] = key;
+    }
+    p.NewTxnRequest(new Put(m));
+    delete p.GetTxnResult();
+
+    // Each txn reads only the one record it picks, whenever it gets to it.
+    for (Key key = 0; key < 20; key++)
+      p.NewTxnRequest(new Pick(declared, key, 0.001));
+    for (int j = 0; j < 20; j++) {
+      t = p.GetTxnResult();
+      EXPECT_EQ(COMMITTED, t->Status());
+      delete t;
+    }
+
+    map<Key, Value> ok;
+    for (Key key = 0; key < 20; key++)
+      ok[key] = key + 1;
+    p.NewTxnRequest(new Expect(ok));  // Should commit
+    t = p.GetTxnResult();
+    EXPECT_EQ(COMMITTED, t->Status());
+    delete t;
+
+    // Missing records are still missing when read on demand.
+    declared.insert(100);
+    p.NewTxnRequest(new Pick(declared, 100));  // Should abort
+    t = p.GetTxnResult();
+    EXPECT_EQ(ABORTED, t->Status());
+    delete t;
+  }
+
+  END;
+}
+
+// Blindly sets 'key' to 'value', taking 'time' seconds to do so.
+class Overwrite : public Txn {
+ public:
+  Overwrite(Key key, Value value, double time)
+      : key_(key), value_(value), time_(time) {
+    writeset_ = {key};
+    blindset_ = {key};
+  }
+
+  Overwrite* clone() const {            // Virtual constructor (copying)
+    Overwrite* clone = new Overwrite(key_, value_, time_);
+    this->CopyTxnInternals(clone);
+    return clone;
+  }
+
+  void Run() {
+    Write(key_, value_);
+    Work(time_);
+    COMMIT;
+  }
+
+ private:
+  Key key_;
+  Value value_;
+  double time_;
+};
+
+TEST(BlindWrites) {
+  CCMode modes[] = {OCC, P_OCC, MOCC, OCC};
+  int options[] = {0, 0, 0, EARLY_ABORT};
+  for (int i = 0; i < 4; i++) {
+    TxnProcessor p(modes[i], options[i]);
+    Txn* t;
+
+    map<Key, Value> m = {{1, 0}};
+    p.NewTxnRequest(new Put(m));
+    delete p.GetTxnResult();
+
+    // The increment commits while the overwrite is still running. The
+    // overwrite never read key 1, so it need not be restarted, and it is
+    // serialized after the increment.
+    p.NewTxnRequest(new Overwrite(1, 5, 1));
+    p.NewTxnRequest(new BankTxn());
+    for (int j = 0; j < 2; j++) {
+      t = p.GetTxnResult();
+      EXPECT_EQ(COMMITTED, t->Status());
+      EXPECT_EQ(0, t->Restarts());
+      delete t;
+    }
+
+    map<Key, Value> ok = {{1, 5}};
+    p.NewTxnRequest(new Expect(ok));  // Should commit
+    t = p.GetTxnResult();
+    EXPECT_EQ(COMMITTED, t->Status());
+    delete t;
+  }
+
+  END;
+}
+
+TEST(RecycledTxns) {
+  TxnProcessor p(P_OCC);
+  Txn* t;
+
+  map<Key, Value> m;
+  for (Key key = 0; key < 100; key++)
+    m[key] = 0;
+  p.NewTxnRequest(new Put(m));
+  delete p.GetTxnResult();
+
+  // The same RMW, writing every key (more than its sets hold inline), is
+  // submitted again after each round as if it were new.
+  RMW* rmw = new RMW(100, 0, 100);
+  for (int round = 1; round <= 3; round++) {
+    p.NewTxnRequest(rmw);
+    t = p.GetTxnResult();
+    EXPECT_EQ(rmw, t);
+    EXPECT_EQ(COMMITTED, t->Status());
+    rmw->Reuse(100, 0, 100);
+    EXPECT_EQ(INCOMPLETE, rmw->Status());
+  }
+  delete rmw;
+
+  map<Key, Value> ok;
+  for (Key key = 0; key < 100; key++)
+    ok[key] = 3;
+  p.NewTxnRequest(new Expect(ok));  // Should commit
+  t = p.GetTxnResult();
+  EXPECT_EQ(COMMITTED, t->Status());
+  delete t;
+
+  END;
+}
+
+// Returns the CPU time, in seconds, used so far by all of this process's
+// threads (or, if 'who' is RUSAGE_THREAD, by the calling thread).
+double CpuTime(int who = RUSAGE_SELF) {
+  struct rusage usage;
+  getrusage(who, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+TEST(IdleProcessorSleeps) {
+  CCMode modes[] = {SERIAL, LOCKING, OCC, P_OCC};
+  for (int i = 0; i < 4; i++) {
+    TxnProcessor p(modes[i]);
+    map<Key, Value> m = {{1, 0}};
+    p.NewTxnRequest(new Put(m));
+    delete p.GetTxnResult();
+
+    // With nothing to do, the scheduler and workers sleep instead of polling,
+    // and so does a client waiting for a result.
+    Txn* t;
+    double cpu = CpuTime();
+    EXPECT_FALSE(p.GetTxnResult(&t, 0.2));
+    EXPECT_TRUE(CpuTime() - cpu < 0.05);
+
+    // ...and still wake up for the next request.
+    p.NewTxnRequest(new BankTxn());
+    t = p.GetTxnResult();
+    EXPECT_EQ(COMMITTED, t->Status());
+    delete t;
+  }
+
+  END;
+}
+
+// Collects txns handed back through completion callbacks.
+class Collector {
+ public:
+  Collector() : count_(0) {}
+
+  void Done(Txn* txn) {
+    mutex_.Lock();
+    txns_.push_back(txn);
+    mutex_.Unlock();
+    count_++;
+  }
+
+  // Waits up to 'timeout' seconds for 'n' txns to have been collected, and
+  // returns the number that were.
+  int WaitFor(int n, double timeout) {
+    double deadline = GetTime() + timeout;
+    while (count_ < n && GetTime() < deadline)
+      usleep(10);
+    return count_;
+  }
+
+  vector<Txn*> txns_;
+
+ private:
+  Mutex mutex_;
+  std::atomic<int> count_;
+};
+
+TEST(ResultDelivery) {
+  CCMode modes[] = {SERIAL, LOCKING, OCC, P_OCC, BAMBOO};
+  for (int i = 0; i < 5; i++) {
+    TxnProcessor p(modes[i]);
+    map<Key, Value> m = {{1, 0}};
+    p.NewTxnRequest(new Put(m));
+    delete p.GetTxnResult();
+
+    // Callbacks get their own txns, which never reach 'GetTxnResult()'.
+    Collector collector;
+    Txn* txns[10];
+    for (int j = 0; j < 10; j++) {
+      txns[j] = new BankTxn();
+      p.NewTxnRequest(txns[j], InlineTask(&collector, &Collector::Done,
+                                          txns[j]));
+    }
+    EXPECT_EQ(10, collector.WaitFor(10, 10));
+    for (int j = 0; j < 10; j++) {
+      EXPECT_EQ(COMMITTED, collector.txns_[j]->Status());
+      EXPECT_TRUE(std::count(txns, txns + 10, collector.txns_[j]) == 1);
+      delete collector.txns_[j];
+    }
+    Txn* t;
+    EXPECT_FALSE(p.GetTxnResult(&t, 0.01));
+
+    // Futures, mixed with ordinary requests.
+    TxnFuture futures[10];
+    for (int j = 0; j < 10; j++) {
+      txns[j] = new BankTxn();
+      p.NewTxnRequest(txns[j], &futures[j]);
+      p.NewTxnRequest(new BankTxn());
+    }
+    for (int j = 0; j < 10; j++) {
+      t = futures[j].Get(10);
+      EXPECT_TRUE(futures[j].Ready());
+      EXPECT_EQ(txns[j], t);
+      EXPECT_EQ(COMMITTED, t->Status());
+      delete t;
+    }
+    for (int j = 0; j < 10; j++) {
+      EXPECT_TRUE(p.GetTxnResult(&t, 10));
+      EXPECT_EQ(COMMITTED, t->Status());
+      delete t;
+    }
+
+    map<Key, Value> ok = {{1, 30}};
+    TxnFuture future;
+    p.NewTxnRequest(new Expect(ok), &future);  // Should commit
+    t = future.Get();
+    EXPECT_EQ(COMMITTED, t->Status());
+    delete t;
+  }
+
+  // A future that no request was made with has nothing to wait for.
+  TxnFuture unused;
+  EXPECT_FALSE(unused.Ready());
+  EXPECT_TRUE(unused.Get() == NULL);
+
+  END;
+}
+
+TEST(BatchedRequests) {
+  CCMode modes[] = {SERIAL, LOCKING, OCC, P_OCC, TO};
+  for (int i = 0; i < 5; i++) {
+    TxnProcessor p(modes[i]);
+    map<Key, Value> m = {{1, 0}};
+    p.NewTxnRequest(new Put(m));
+    delete p.GetTxnResult();
+
+    Txn* txns[50];
+    for (int j = 0; j < 50; j++)
+      txns[j] = new BankTxn();
+    p.NewTxnRequests(txns, 50);
+
+    // Results come back in batches of at most 16.
+    int done = 0;
+    while (done < 50) {
+      int n = p.GetTxnResults(txns, 16, 10);
+      EXPECT_TRUE(n > 0 && n <= 16);
+      if (n == 0)
+        break;
+      for (int j = 0; j < n; j++) {
+        EXPECT_EQ(COMMITTED, txns[j]->Status());
+        delete txns[j];
+      }
+      done += n;
+    }
+    EXPECT_EQ(50, done);
+    EXPECT_EQ(0, p.GetTxnResults(txns, 16, 0.01));
+
+    map<Key, Value> ok = {{1, 50}};
+    p.NewTxnRequest(new Expect(ok));  // Should commit
+    Txn* t = p.GetTxnResult();
+    EXPECT_EQ(COMMITTED, t->Status());
+    delete t;
+  }
+
+  END;
+}
+
+// Client thread that submits BankTxns through its own session and checks
+// that it gets back exactly those.
+struct SessionClient {
+  TxnSession* session;
+  Txn* txns[25];
+  int matched;
+
+  static void* Run(void* arg) {
+    SessionClient* client = reinterpret_cast<SessionClient*>(arg);
+    for (int i = 0; i < 25; i++) {
+      client->txns[i] = new BankTxn();
+      client->session->NewTxnRequest(client->txns[i]);
+    }
+    client->matched = 0;
+    Txn* results[25];
+    for (int got = 0; got < 25; ) {
+      int n = client->session->GetTxnResults(results + got, 25 - got, 10);
+      if (n == 0)
+        break;
+      got += n;
+    }
+    for (int i = 0; i < 25; i++) {
+      if (std::count(results, results + 25, client->txns[i]) == 1 &&
+          client->txns[i]->Status() == COMMITTED)
+        client->matched++;
+    }
+    for (int i = 0; i < 25; i++)
+      delete client->txns[i];
+    return NULL;
+  }
+};
+
+TEST(Sessions) {
+  CCMode modes[] = {SERIAL, LOCKING, OCC, P_OCC, TO};
+  for (int i = 0; i < 5; i++) {
+    TxnProcessor p(modes[i]);
+    map<Key, Value> m = {{1, 0}};
+    p.NewTxnRequest(new Put(m));
+    delete p.GetTxnResult();
+
+    SessionClient clients[4];
+    pthread_t threads[4];
+    for (int j = 0; j < 4; j++) {
+      clients[j].session = p.NewSession();
+      pthread_create(&threads[j], NULL, SessionClient::Run, &clients[j]);
+    }
+    for (int j = 0; j < 4; j++) {
+      pthread_join(threads[j], NULL);
+      EXPECT_EQ(25, clients[j].matched);
+    }
+
+    // Nothing was delivered to the shared queue.
+    Txn* t;
+    EXPECT_FALSE(p.GetTxnResult(&t, 0.01));
+
+    map<Key, Value> ok = {{1, 100}};
+    p.NewTxnRequest(new Expect(ok));  // Should commit
+    t = p.GetTxnResult();
+    EXPECT_EQ(COMMITTED, t->Status());
+    delete t;
+  }
+
+  END;
+}
+
+TEST(MVTOSessions) {
+  TxnProcessor p(MVTO);
+  map<Key, Value> m = {{1, 0}};
+  p.NewTxnRequest(new Put(m));
+  delete p.GetTxnResult();
+
+  // Keep the scheduler busy while both sessions queue blind writes to one
+  // key, so that their requests are then admitted alternately, each of the
+  // first session's behind a later request of the second's. Timestamps are
+  // given out on admission, so none of them is older than a version that
+  // has already been discarded, and none restarts.
+  Txn* noops[1000];
+  for (int i = 0; i < 1000; i++)
+    noops[i] = new Noop();
+  p.NewTxnRequests(noops, 1000);
+
+  TxnSession* sessions[2] = {p.NewSession(), p.NewSession()};
+  Txn* txns[2][50];
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < 50; j++) {
+      map<Key, Value> update = {{1, 50 * i + j + 1}};
+      txns[i][j] = new Put(update);
+    }
+    sessions[i]->NewTxnRequests(txns[i], 50);
+  }
+
+  for (int i = 0; i < 1000; i++)
+    delete p.GetTxnResult();
+  int restarts = 0;
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < 50; j++) {
+      Txn* t = sessions[i]->GetTxnResult();
+      EXPECT_EQ(COMMITTED, t->Status());
+      restarts += t->Restarts();
+      delete t;
+    }
+  }
+  EXPECT_EQ(0, restarts);
+
+  END;
+}
+
+TEST(ThreadOptions) {
+  CpuTopology topology;
+  vector<int> cpus = topology.Cpus();
+  EXPECT_TRUE(cpus.size() > 0);
+  EXPECT_TRUE(topology.Cores() >= 1);
+  EXPECT_TRUE(topology.Cores() <= static_cast<int>(cpus.size()));
+  EXPECT_TRUE(topology.SameCore(cpus[0], cpus[0]));
+
+  // Only CPUs this process may run on are used, and pinning to any other
+  // fails without moving the thread.
+  cpu_set_t allowed;
+  EXPECT_EQ(0, sched_getaffinity(0, sizeof(allowed), &allowed));
+  for (uint32 i = 0; i < cpus.size(); i++)
+    EXPECT_TRUE(CPU_ISSET(cpus[i], &allowed));
+  EXPECT_FALSE(PinThread(pthread_self(), CPU_SETSIZE - 1));
+  cpu_set_t after;
+  EXPECT_EQ(0, sched_getaffinity(0, sizeof(after), &after));
+  EXPECT_TRUE(CPU_EQUAL(&allowed, &after));
+
+  // The smallest pool (a scheduler and one worker), with and without pinning.
+  CCMode modes[] = {SERIAL, LOCKING, OCC, P_OCC};
+  for (int i = 0; i < 8; i++) {
+    TxnProcessor p(modes[i % 4], i < 4 ? 0 : PIN_THREADS, 2);
+    map<Key, Value> m = {{1, 0}};
+    p.NewTxnRequest(new Put(m));
+    delete p.GetTxnResult();
+
+    Txn* txns[20];
+    for (int j = 0; j < 20; j++)
+      txns[j] = new BankTxn();
+    p.NewTxnRequests(txns, 20);
+    for (int j = 0; j < 20; j++) {
+      Txn* t = p.GetTxnResult();
+      EXPECT_EQ(COMMITTED, t->Status());
+      delete t;
+    }
+
+    map<Key, Value> ok = {{1, 20}};
+    p.NewTxnRequest(new Expect(ok));  // Should commit
+    Txn* t = p.GetTxnResult();
+    EXPECT_EQ(COMMITTED, t->Status());
+    delete t;
+  }
+
+  END;
+}
+
+// Returns a human-readable string naming of the providing mode.
+string ModeToString(CCMode mode) {
+  switch (mode) {
+    case SERIAL:                 return " Serial   ";
+    case LOCKING_EXCLUSIVE_ONLY: return " Locking A";
+    case LOCKING:                return " Locking B";
+    case OCC:                    return " OCC      ";
+    case P_OCC:                  return " OCC-P    ";
+    case MOCC:                   return " MOCC     ";
+    case ADAPTIVE:               return " Adaptive ";
+    case SI:                     return " SI       ";
+    case SSI:                    return " SSI      ";
+    case TO:                     return " T/O      ";
+    case MVTO:                   return " MVTO     ";
+    case BAMBOO:                 return " Bamboo   ";
+    default:                     return "INVALID MODE";
+  }
+}
+
+class LoadGen {
+ public:
+  virtual ~LoadGen() {
+    for (uint32 i = 0; i < free_.size(); i++)
+      delete free_[i];
+  }
+  virtual Txn* NewTxn() = 0;
+
+  // Called at the start of each experiment.
+  virtual void Start() {}
+
+  // Takes back a txn returned by 'NewTxn()' once the benchmark is done with
+  // it. Generators of random RMW txns set it up again in a later 'NewTxn()'
+  // instead of allocating a new one; the others just delete it.
+  virtual void Recycle(Txn* txn) { delete txn; }
+
+ protected:
+  // Returns a recycled RMW, set up again with randomized read/write sets, or
+  // a new one if there is none.
+  RMW* NewRMW(int dbsize, int rsetsize, int wsetsize, double wait_time) {
+    if (free_.empty())
+      return new RMW(dbsize, rsetsize, wsetsize, wait_time);
+    RMW* txn = free_.back();
+    free_.pop_back();
+    txn->Reuse(dbsize, rsetsize, wsetsize, wait_time);
+    return txn;
+  }
+
+  // Keeps a finished RMW for 'NewRMW()'.
+  void RecycleRMW(Txn* txn) { free_.push_back(static_cast<RMW*>(txn)); }
+
+ private:
+  vector<RMW*> free_;
+};
+
+class RMWLoadGen : public LoadGen {
+ public:
+  RMWLoadGen(int dbsize, int rsetsize, int wsetsize, double wait_time)
+    : dbsize_(dbsize),
+      rsetsize_(rsetsize),
+      wsetsize_(wsetsize),
+      wait_time_(wait_time) {
+  }
+
+  virtual Txn* NewTxn() {
+    return NewRMW(dbsize_, rsetsize_, wsetsize_, wait_time_);
+  }
+
+  virtual void Recycle(Txn* txn) { RecycleRMW(txn); }
+
+ private:
+  int dbsize_;
+  int rsetsize_;
+  int wsetsize_;
+  double wait_time_;
+};
+
+class IncrementLoadGen : public LoadGen {
+ public:
+  IncrementLoadGen(int dbsize, int rsetsize, int dsetsize, double wait_time)
+    : dbsize_(dbsize),
+      rsetsize_(rsetsize),
+      dsetsize_(dsetsize),
+      wait_time_(wait_time) {
+  }
+
+  virtual Txn* NewTxn() {
+    return new Increment(dbsize_, rsetsize_, dsetsize_, wait_time_);
+  }
+
+ private:
+  int dbsize_;
+  int rsetsize_;
+  int dsetsize_;
+  double wait_time_;
+};
+
+class RMWLoadGen2 : public LoadGen {
+ public:
+  RMWLoadGen2(int dbsize, int rsetsize, int wsetsize, double wait_time)
+    : dbsize_(dbsize),
+      rsetsize_(rsetsize),
+      wsetsize_(wsetsize),
+      wait_time_(wait_time) {
+  }
+
+  virtual Txn* NewTxn() {
+    // 10% of transactions are READ only transactions and run for the full
+    // transaction duration. The rest are very fast (< 0.1ms), high-contention
+    // (65%+) updates.
+    if (rand() % 100 < 10)
+      return NewRMW(dbsize_, rsetsize_, 0, wait_time_);
+    else
+      return NewRMW(dbsize_, 0, wsetsize_, 0);
+  }
+
+  virtual void Recycle(Txn* txn) { RecycleRMW(txn); }
+
+ private:
+  int dbsize_;
+  int rsetsize_;
+  int wsetsize_;
+  double wait_time_;
+};
+
+// Blind writes of 'wsetsize' random keys.
+class PutLoadGen : public LoadGen {
+ public:
+  PutLoadGen(int dbsize, int wsetsize) : dbsize_(dbsize), wsetsize_(wsetsize) {
+  }
+
+  virtual Txn* NewTxn() {
+    map<Key, Value> m;
+    while (m.size() < static_cast<uint32>(wsetsize_))
+      m[rand() % dbsize_] = 1;
+    return new Put(m);
+  }
+
+ private:
+  int dbsize_;
+  int wsetsize_;
+};
+
+// Shopping txns for random accounts. The item (key 1) is out of stock, so no
+// account is ever read.
+class ShoppingLoadGen : public LoadGen {
+ public:
+  ShoppingLoadGen(int dbsize, double wait_time)
+    : dbsize_(dbsize), wait_time_(wait_time) {
+  }
+
+  virtual Txn* NewTxn() {
+    return new Shopping(2 + rand() % (dbsize_ - 2), wait_time_);
+  }
+
+ private:
+  int dbsize_;
+  double wait_time_;
+};
+
+// Pick txns that declare 'wsetsize' random keys and use only one of them.
+class PickLoadGen : public LoadGen {
+ public:
+  PickLoadGen(int dbsize, int wsetsize, double wait_time)
+    : dbsize_(dbsize), wsetsize_(wsetsize), wait_time_(wait_time) {
+  }
+
+  virtual Txn* NewTxn() {
+    set<Key> writeset;
+    while (writeset.size() < static_cast<uint32>(wsetsize_))
+      writeset.insert(rand() % dbsize_);
+    return new Pick(writeset, *writeset.begin(), wait_time_);
+  }
+
+ private:
+  int dbsize_;
+  int wsetsize_;
+  double wait_time_;
+};
+
+// Read-modify-write load in which a small set of 'hotsize' keys absorbs a
+// fraction 'hot_fraction' of all accesses. The remaining accesses are spread
+// uniformly over the rest of the database.
+class HotKeyLoadGen : public LoadGen {
+ public:
+  HotKeyLoadGen(int dbsize, int hotsize, int rsetsize, int wsetsize,
+                double hot_fraction, double wait_time)
+    : dbsize_(dbsize),
+      hotsize_(hotsize),
+      rsetsize_(rsetsize),
+      wsetsize_(wsetsize),
+      hot_fraction_(hot_fraction),
+      wait_time_(wait_time) {
+    DCHECK(hotsize_ >= rsetsize_ + wsetsize_);
+  }
+
+  virtual Txn* NewTxn() {
+    set<Key> readset;
+    set<Key> writeset;
+    for (int i = 0; i < rsetsize_; i++)
+      readset.insert(NewKey(readset, writeset));
+    for (int i = 0; i < wsetsize_; i++)
+      writeset.insert(NewKey(readset, writeset));
+    return new RMW(readset, writeset, wait_time_);
+  }
+
+ private:
+  // Returns a key that appears in neither 'readset' nor 'writeset'.
+  Key NewKey(const set<Key>& readset, const set<Key>& writeset) {
+    Key key;
+    do {
+      if (RandomDouble(1.0) < hot_fraction_)
+        key = rand() % hotsize_;
+      else
+        key = hotsize_ + rand() % (dbsize_ - hotsize_);
+    } while (readset.count(key) || writeset.count(key));
+    return key;
+  }
+
+  int dbsize_;
+  int hotsize_;
+  int rsetsize_;
+  int wsetsize_;
+  double hot_fraction_;
+  double wait_time_;
+};
+
+// Generates txns from 'first' for the first 'duration' seconds of each
+// experiment, and from 'second' after that.
+class PhasedLoadGen : public LoadGen {
+ public:
+  PhasedLoadGen(LoadGen* first, LoadGen* second, double duration)
+    : first_(first), second_(second), duration_(duration), start_(0) {
+  }
+
+  virtual ~PhasedLoadGen() {
+    delete first_;
+    delete second_;
+  }
+
+  virtual void Start() {
+    start_ = GetTime();
+  }
+
+  virtual Txn* NewTxn() {
+    if (GetTime() < start_ + duration_)
+      return first_->NewTxn();
+    else
+      return second_->NewTxn();
+  }
+
+  virtual void Recycle(Txn* txn) {
+    if (GetTime() < start_ + duration_)
+      first_->Recycle(txn);
+    else
+      second_->Recycle(txn);
+  }
+
+ private:
+  LoadGen* first_;
+  LoadGen* second_;
+  double duration_;
+  double start_;
+};
+
+// Runs each experiment in 'lg' under each of 'modes', printing throughput. If
+// 'restarts' is set, also prints the average and maximum number of times each
+// txn was restarted by concurrency control before it completed, the average
+// execution time (in ms) those restarted attempts wasted, and the 99th and
+// 99.9th percentile latency (in ms). 'options' are passed on to each
+// TxnProcessor.
+void Benchmark(const vector<LoadGen*>& lg, const vector<CCMode>& modes,
+               bool restarts, int options = 0) {
+  // Number of transaction requests that can be active at any given time.
+  int active_txns = 100;
+
+  // Set initial db state.
+  map<Key, Value> db_init;
+  for (int i = 0; i < 10000; i++)
+    db_init[i] = 0;
+
+  // For each MODE...
+  for (uint32 m = 0; m < modes.size(); m++) {
+    CCMode mode = modes[m];
+
+    // Print out mode name.
+    cout << ModeToString(mode) << flush;
+
+    // For each experiment...
+    for (uint32 exp = 0; exp < lg.size(); exp++) {
+      int txn_count = 0;
+
+      // Restarts, wasted time and latency of each completed txn. Txns are
+      // handed back to the load generator for reuse as soon as these are
+      // recorded.
+      int restart_count = 0;
+      int max_restarts = 0;
+      double wasted = 0;
+      vector<double> latencies;
+
+      // Create TxnProcessor in next mode.
+      TxnProcessor* p = new TxnProcessor(mode, options);
+
+      // Initialize data with initial db state.
+      Put init_txn(db_init);
+      p->NewTxnRequest(&init_txn);
+      p->GetTxnResult();
+
+      // Record start time.
+      double start = GetTime();
+      lg[exp]->Start();
+
+      // Start specified number of txns running.
+      for (int i = 0; i < active_txns; i++)
+        p->NewTxnRequest(lg[exp]->NewTxn());
+
+      // Keep 100 active txns at all times for the first full second, then
+      // wait for all of them to finish.
+      for (int remaining = active_txns; remaining > 0; ) {
+        Txn* txn = p->GetTxnResult();
+        txn_count++;
+        restart_count += txn->Restarts();
+        max_restarts = std::max(max_restarts, txn->Restarts());
+        wasted += txn->WastedTime();
+        latencies.push_back(txn->Latency());
+        lg[exp]->Recycle(txn);
+
+        if (GetTime() < start + 1)
+          p->NewTxnRequest(lg[exp]->NewTxn());
+        else
+          remaining--;
+      }
+
+      // Record end time.
+      double end = GetTime();
+
+      // Print throughput
+      cout << "\t" << (txn_count / (end-start)) << "\t" << flush;
+
+      // Print restarts, wasted time and tail latency per txn.
+      if (restarts) {
+        std::sort(latencies.begin(), latencies.end());
+        cout << "(" << static_cast<double>(restart_count) / txn_count
+             << ", max " << max_restarts
+             << ", " << 1000 * wasted / txn_count << "ms"
+             << ", p99 " << 1000 * latencies[latencies.size() * 99 / 100]
+             << "ms, p999 " << 1000 * latencies[latencies.size() * 999 / 1000]
+             << "ms)\t" << flush;
+      }
+
+      // Delete TxnProcessor.
+      delete p;
+    }
+
+    cout << endl;
+  }
+}
+
+// Returns every mode, in order.
+vector<CCMode> AllModes() {
+  vector<CCMode> modes;
+  for (CCMode mode = SERIAL;
+      mode <= BAMBOO;
+      mode = static_cast<CCMode>(mode+1)) {
+    modes.push_back(mode);
+  }
+  return modes;
+}
+
+// Runs each experiment in 'lg' under every mode, printing throughput.
+void Benchmark(const vector<LoadGen*>& lg) {
+  Benchmark(lg, AllModes(), false);
+}
+
+// Prints, for each of the SERIAL, LOCKING, OCC and P_OCC schedulers, the CPU
+// an idle TxnProcessor uses (as a fraction of one core), and the median and
+// 99th percentile latency (in ms) of 0.1ms txns under light load (one txn at
+// a time) and heavy load (100 at a time).
+void WakeupBenchmark() {
+  cout << "Idle CPU and latency (p50/p99 ms)" << endl;
+  cout << "\t\tidle CPU\tlight load\theavy load" << endl;
+  RMWLoadGen lg(10000, 10, 10, 0.0001);
+  CCMode modes[] = {SERIAL, LOCKING, OCC, P_OCC};
+  for (int m = 0; m < 4; m++) {
+    TxnProcessor* p = new TxnProcessor(modes[m]);
+    cout << ModeToString(modes[m]) << flush;
+
+    double cpu = CpuTime();
+    Sleep(1);
+    cout << "\t" << CpuTime() - cpu << flush;
+
+    int loads[] = {1, 100};
+    for (int l = 0; l < 2; l++) {
+      vector<double> latencies;
+      for (int i = 0; i < loads[l]; i++)
+        p->NewTxnRequest(lg.NewTxn());
+      double start = GetTime();
+      for (int remaining = loads[l]; remaining > 0; ) {
+        Txn* txn = p->GetTxnResult();
+        latencies.push_back(txn->Latency());
+        lg.Recycle(txn);
+        if (GetTime() < start + 1)
+          p->NewTxnRequest(lg.NewTxn());
+        else
+          remaining--;
+      }
+      std::sort(latencies.begin(), latencies.end());
+      cout << "\t\t" << 1000 * latencies[latencies.size() / 2] << "/"
+           << 1000 * latencies[latencies.size() * 99 / 100] << flush;
+    }
+    cout << endl;
+
+    delete p;
+  }
+}
+
+// Submits 0.1ms txns one at a time for a second under OCC, receiving each
+// through 'GetTxnResult()', a TxnFuture or a completion callback, and prints
+// the median and 99th percentile time (in us) from submission until the
+// client has the result, as well as the CPU used (as a fraction of one core).
+void DeliveryBenchmark() {
+  cout << "Result delivery (p50/p99 us, CPU)" << endl;
+  cout << "GetTxnResult\t\tfuture\t\t\tcallback" << endl;
+  RMWLoadGen lg(10000, 10, 10, 0.0001);
+  TxnProcessor p(OCC);
+  for (int method = 0; method < 3; method++) {
+    vector<double> latencies;
+    double start = GetTime();
+    double cpu = CpuTime();
+    while (GetTime() < start + 1) {
+      Txn* txn = lg.NewTxn();
+      double submitted = GetTime();
+      if (method == 0) {
+        p.NewTxnRequest(txn);
+        txn = p.GetTxnResult();
+      } else if (method == 1) {
+        TxnFuture future;
+        p.NewTxnRequest(txn, &future);
+        txn = future.Get();
+      } else {
+        Collector collector;
+        p.NewTxnRequest(txn, InlineTask(&collector, &Collector::Done, txn));
+        collector.WaitFor(1, 10);
+      }
+      latencies.push_back(GetTime() - submitted);
+      lg.Recycle(txn);
+    }
+    double used = (CpuTime() - cpu) / (GetTime() - start);
+    std::sort(latencies.begin(), latencies.end());
+    cout << 1e6 * latencies[latencies.size() / 2] << "/"
+         << 1e6 * latencies[latencies.size() * 99 / 100] << ", " << used
+         << "\t\t" << flush;
+  }
+  cout << endl;
+}
+
+// Keeps 100 Noop txns, then 100 small RMWs (2 reads, 2 writes, no work)
+// active under OCC for a second, submitting and collecting them one at a
+// time or in batches of up to 16 or 100. Prints throughput (txns/s) and the
+// client thread's CPU time per txn (us).
+void BatchBenchmark() {
+  cout << "Batched requests (txns/s, client CPU us/txn)" << endl;
+  cout << "\t\tbatch 1\t\t\tbatch 16\t\t\tbatch 100" << endl;
+  for (int workload = 0; workload < 2; workload++) {
+    RMWLoadGen rmw(10000, 2, 2, 0);
+    cout << (workload == 0 ? "Noop" : "Small RMW") << flush;
+    int batches[] = {1, 16, 100};
+    for (int b = 0; b < 3; b++) {
+      int batch = batches[b];
+      TxnProcessor p(OCC);
+      Txn* txns[100];
+      int txn_count = 0;
+
+      double start = GetTime();
+      double cpu = CpuTime(RUSAGE_THREAD);
+      for (int i = 0; i < 100; i++)
+        txns[i] = workload == 0 ? new Noop() : rmw.NewTxn();
+      p.NewTxnRequests(txns, 100);
+      for (int remaining = 100; remaining > 0; ) {
+        int n = 1;
+        if (batch == 1)
+          txns[0] = p.GetTxnResult();
+        else
+          n = p.GetTxnResults(txns, batch);
+        txn_count += n;
+
+        int more = GetTime() < start + 1 ? n : 0;
+        for (int i = 0; i < n; i++) {
+          if (workload == 0) {
+            delete txns[i];
+            if (i < more)
+              txns[i] = new Noop();
+          } else {
+            rmw.Recycle(txns[i]);
+            if (i < more)
+              txns[i] = rmw.NewTxn();
+          }
+        }
+        if (batch == 1 && more > 0)
+          p.NewTxnRequest(txns[0]);
+        else if (more > 0)
+          p.NewTxnRequests(txns, more);
+        remaining -= n - more;
+      }
+      cout << "\t" << txn_count / (GetTime() - start) << " ("
+           << 1e6 * (CpuTime(RUSAGE_THREAD) - cpu) / txn_count << ")" << flush;
+    }
+    cout << endl;
+  }
+}
+
+// Client thread for 'SessionBenchmark()', keeping 10 small RMWs active until
+// 'end' through 'session', or through the TxnProcessor's shared queues if
+// 'session' is NULL.
+struct LoadClient {
+  TxnProcessor* p;
+  TxnSession* session;
+  double end;
+  int completed;
+
+  void Submit(Txn* txn) {
+    if (session != NULL)
+      session->NewTxnRequest(txn);
+    else
+      p->NewTxnRequest(txn);
+  }
+
+  static void* Run(void* arg) {
+    LoadClient* client = reinterpret_cast<LoadClient*>(arg);
+    RMWLoadGen lg(10000, 2, 2, 0.0001);
+    for (int i = 0; i < 10; i++)
+      client->Submit(lg.NewTxn());
+    client->completed = 0;
+    while (GetTime() < client->end) {
+      Txn* txn;
+      bool got = client->session != NULL ?
+                 client->session->GetTxnResult(&txn, 0.01) :
+                 client->p->GetTxnResult(&txn, 0.01);
+      if (!got)
+        continue;
+      client->completed++;
+      lg.Recycle(txn);
+      client->Submit(lg.NewTxn());
+    }
+    return NULL;
+  }
+};
+
+// Runs 1 to 32 client threads, each keeping 10 0.1ms RMWs active under OCC
+// for a second, either all through the shared 'NewTxnRequest()' and
+// 'GetTxnResult()' or each through its own session. Prints throughput
+// (txns/s).
+void SessionBenchmark() {
+  cout << "Concurrent clients (txns/s)" << endl;
+  cout << "clients\t\tshared\t\tsessions" << endl;
+  for (int clients = 1; clients <= 32; clients *= 2) {
+    cout << clients << flush;
+    for (int sessions = 0; sessions < 2; sessions++) {
+      TxnProcessor p(OCC);
+      vector<LoadClient> load(clients);
+      vector<pthread_t> threads(clients);
+      double start = GetTime();
+      for (int i = 0; i < clients; i++) {
+        load[i].p = &p;
+        load[i].session = sessions ? p.NewSession() : NULL;
+        load[i].end = start + 1;
+        pthread_create(&threads[i], NULL, LoadClient::Run, &load[i]);
+      }
+      int completed = 0;
+      for (int i = 0; i < clients; i++) {
+        pthread_join(threads[i], NULL);
+        completed += load[i].completed;
+      }
+      cout << "\t\t" << completed / (GetTime() - start) << flush;
+
+      // Throw away the txns still active.
+      Txn* txn;
+      for (int i = 0; i < clients; i++) {
+        while (sessions ? load[i].session->GetTxnResult(&txn, 0.1) :
+                          p.GetTxnResult(&txn, 0.1))
+          delete txn;
+      }
+    }
+    cout << endl;
+  }
+}
+
+// Runs 0.1ms and no-wait RMWs (10 keys read, 10 written, out of 10000)
+// under each of the SERIAL, LOCKING, OCC and P_OCC schedulers, with 1, 2, 4
+// and 8 workers per core (plus the scheduler's thread) and with the default
+// pool size, each with and without PIN_THREADS. Keeps 100 txns active for a
+// second and prints throughput (txns/s), marking each row's best with '*'.
+void ThreadSweepBenchmark() {
+  int cores = CpuTopology().Cores();
+  vector<int> counts;
+  for (int workers = 1; workers <= 8; workers *= 2)
+    counts.push_back(workers * cores + 1);
+  counts.push_back(0);
+
+  cout << "Thread pool sizing (txns/s; " << cores << " cores, "
+       << CpuTopology().Cpus().size() << " CPUs)" << endl;
+  cout << "threads";
+  for (uint32 i = 0; i < counts.size(); i++) {
+    string threads = counts[i] == 0 ? "default" : IntToString(counts[i]);
+    cout << "\t" << threads << "\t\t" << threads << " pinned";
+  }
+  cout << endl;
+
+  double waits[] = {0.0001, 0};
+  CCMode modes[] = {SERIAL, LOCKING, OCC, P_OCC};
+  for (int w = 0; w < 2; w++) {
+    cout << (w == 0 ? "0.1ms RMW" : "No-wait RMW") << endl;
+    for (int m = 0; m < 4; m++) {
+      vector<double> throughputs;
+      for (uint32 i = 0; i < counts.size(); i++) {
+        for (int pin = 0; pin < 2; pin++) {
+          RMWLoadGen lg(10000, 10, 10, waits[w]);
+          TxnProcessor p(modes[m], pin ? PIN_THREADS : 0, counts[i]);
+          int txn_count = 0;
+          double start = GetTime();
+          for (int j = 0; j < 100; j++)
+            p.NewTxnRequest(lg.NewTxn());
+          for (int remaining = 100; remaining > 0; ) {
+            lg.Recycle(p.GetTxnResult());
+            txn_count++;
+            if (GetTime() < start + 1)
+              p.NewTxnRequest(lg.NewTxn());
+            else
+              remaining--;
+          }
+          throughputs.push_back(txn_count / (GetTime() - start));
+        }
+      }
+
+      int best = std::max_element(throughputs.begin(), throughputs.end()) -
+                 throughputs.begin();
+      cout << ModeToString(modes[m]);
+      for (uint32 i = 0; i < throughputs.size(); i++) {
+        cout << "\t" << static_cast<int>(throughputs[i])
+             << (static_cast<int>(i) == best ? "*" : "") << "\t";
+      }
+      cout << endl;
+    }
+  }
+}
+
+// Runs the tests and the throughput tables, and also the wakeup, delivery,
+// batching, session and thread count sweeps if given '--sweeps'.
+int main(int argc, char** argv) {
+  vector<LoadGen *> lg;
+
+  NoopTest();
+  PutTest();
+  BasicBank();
+  ShoppingTest();
+  MOCCBank();
+  ReadOnlyFastPath();
+  SnapshotWriteSkew();
+  AdaptiveModeSwitch();
+  TimestampOrdering();
+  LateWriteAfterYoungerCommit();
+  EarlyAbort();
+  Repair();
+  RetryQueue();
+  Bamboo();
+  CommutativeUpdates();
+  SplitHotKeys();
+  OnDemandReads();
+  BlindWrites();
+  RecycledTxns();
+  IdleProcessorSleeps();
+  ResultDelivery();
+  BatchedRequests();
+  Sessions();
+  MVTOSessions();
+  ThreadOptions();
+
+  cout << "\t\t\t    Average Transaction Duration" << endl;
+  cout << "\t\t0.1ms\t\t1ms\t\t10ms\t\t100ms";
+  cout << endl;
+
+  cout << "Read only" << endl;
+  lg.push_back(new RMWLoadGen(10000, 10, 0, 0.0001));
+  lg.push_back(new RMWLoadGen(10000, 10, 0, 0.001));
+  lg.push_back(new RMWLoadGen(10000, 10, 0, 0.01));
+  lg.push_back(new RMWLoadGen(10000, 10, 0, 0.1));
+
+  Benchmark(lg);
+
+  for (uint32 i = 0; i < lg.size(); i++)
+    delete lg[i];
+  lg.clear();
+
+  cout << "1% contention" << endl;
+  lg.push_back(new RMWLoadGen(10000, 10, 10, 0.0001));
+  lg.push_back(new RMWLoadGen(10000, 10, 10, 0.001));
+  lg.push_back(new RMWLoadGen(10000, 10, 10, 0.01));
+  lg.push_back(new RMWLoadGen(10000, 10, 10, 0.1));
+
+  Benchmark(lg);
+
+  for (uint32 i = 0; i < lg.size(); i++)
+    delete lg[i];
+  lg.clear();
+
+  cout << "10% contention" << endl;
+  lg.push_back(new RMWLoadGen(1000, 10, 10, 0.0001));
+  lg.push_back(new RMWLoadGen(1000, 10, 10, 0.001));
+  lg.push_back(new RMWLoadGen(1000, 10, 10, 0.01));
+  lg.push_back(new RMWLoadGen(1000, 10, 10, 0.1));
+
+  Benchmark(lg);
+
+  for (uint32 i = 0; i < lg.size(); i++)
+    delete lg[i];
+  lg.clear();
+
+  cout << "65% contention" << endl;
+  lg.push_back(new RMWLoadGen(100, 10, 10, 0.0001));
+  lg.push_back(new RMWLoadGen(100, 10, 10, 0.001));
+  lg.push_back(new RMWLoadGen(100, 10, 10, 0.01));
+  lg.push_back(new RMWLoadGen(100, 10, 10, 0.1));
+
+  Benchmark(lg);
+
+  for (uint32 i = 0; i < lg.size(); i++)
+    delete lg[i];
+  lg.clear();
+
+  cout << "100% contention" << endl;
+  lg.push_back(new RMWLoadGen(10, 0, 10, 0.0001));
+  lg.push_back(new RMWLoadGen(10, 0, 10, 0.001));
+  lg.push_back(new RMWLoadGen(10, 0, 10, 0.01));
+  lg.push_back(new RMWLoadGen(10, 0, 10, 0.1));
+
+
+  Benchmark(lg);
+
+  for (uint32 i = 0; i < lg.size(); i++)
+    delete lg[i];
+  lg.clear();
+
+  cout << "High contention mixed read/write" << endl;
+  lg.push_back(new RMWLoadGen2(100, 20, 10, 0.0001));
+  lg.push_back(new RMWLoadGen2(100, 20, 10, 0.001));
+  lg.push_back(new RMWLoadGen2(100, 20, 10, 0.01));
+  lg.push_back(new RMWLoadGen2(100, 20, 10, 0.1));
+
+  Benchmark(lg);
+
+  for (uint32 i = 0; i < lg.size(); i++)
+    delete lg[i];
+  lg.clear();
+
+  cout << "Snapshot isolation vs. OCC and locking "
+       << "(restarts, wasted time per txn)" << endl;
+  vector<CCMode> snapshot_modes = {LOCKING, OCC, SI, SSI};
+
+  cout << "High contention mixed read/write" << endl;
+  lg.push_back(new RMWLoadGen2(100, 20, 10, 0.0001));
+  lg.push_back(new RMWLoadGen2(100, 20, 10, 0.001));
+  lg.push_back(new RMWLoadGen2(100, 20, 10, 0.01));
+  lg.push_back(new RMWLoadGen2(100, 20, 10, 0.1));
+
+  Benchmark(lg, snapshot_modes, true);
+
+  for (uint32 i = 0; i < lg.size(); i++)
+    delete lg[i];
+  lg.clear();
+
+  cout << "65% contention" << endl;
+  lg.push_back(new RMWLoadGen(100, 10, 10, 0.0001));
+  lg.push_back(new RMWLoadGen(100, 10, 10, 0.001));
+  lg.push_back(new RMWLoadGen(100, 10, 10, 0.01));
+  lg.push_back(new RMWLoadGen(100, 10, 10, 0.1));
+
+  Benchmark(lg, snapshot_modes, true);
+
+  for (uint32 i = 0; i < lg.size(); i++)
+    delete lg[i];
+  lg.clear();
+
+  cout << "Timestamp ordering vs. OCC (restarts, wasted time per txn)" << endl;
+  vector<CCMode> to_modes = {OCC, TO, MVTO};
+
+  cout << "10% contention" << endl;
+  lg.push_back(new RMWLoadGen(1000, 10, 10, 0.0001));
+  lg.push_back(new RMWLoadGen(1000, 10, 10, 0.001));
+  lg.push_back(new RMWLoadGen(1000, 10, 10, 0.01));
+  lg.push_back(new RMWLoadGen(1000, 10, 10, 0.1));
+
+  Benchmark(lg, to_modes, true);
+
+  for (uint32 i = 0; i < lg.size(); i++)
+    delete lg[i];
+  lg.clear();
+
+  cout << "65% contention" << endl;
+  lg.push_back(new RMWLoadGen(100, 10, 10, 0.0001));
+  lg.push_back(new RMWLoadGen(100, 10, 10, 0.001));
+  lg.push_back(new RMWLoadGen(100, 10, 10, 0.01));
+  lg.push_back(new RMWLoadGen(100, 10, 10, 0.1));
+
+  Benchmark(lg, to_modes, true);
+
+  for (uint32 i = 0; i < lg.size(); i++)
+    delete lg[i];
+  lg.clear();
+
+  cout << "Early abort in OCC and OCC-P (restarts, wasted time per txn)"
+       << endl;
+  cout << "\t\t10ms\t\t\t\t100ms" << endl;
+  vector<CCMode> occ_modes = {OCC, P_OCC};
+
+  cout << "10% contention" << endl;
+  lg.push_back(new RMWLoadGen(1000, 10, 10, 0.01));
+  lg.push_back(new RMWLoadGen(1000, 10, 10, 0.1));
+
+  cout << "  validation only" << endl;
+  Benchmark(lg, occ_modes, true);
+  cout << "  early abort" << endl;
+  Benchmark(lg, occ_modes, true, EARLY_ABORT);
+
+  for (uint32 i = 0; i < lg.size(); i++)
+    delete lg[i];
+  lg.clear();
+
+  cout << "65% contention" << endl;
+  lg.push_back(new RMWLoadGen(100, 10, 10, 0.01));
+  lg.push_back(new RMWLoadGen(100, 10, 10, 0.1));
+
+  cout << "  validation only" << endl;
+  Benchmark(lg, occ_modes, true);
+  cout << "  early abort" << endl;
+  Benchmark(lg, occ_modes, true, EARLY_ABORT);
+
+  for (uint32 i = 0; i < lg.size(); i++)
+    delete lg[i];
+  lg.clear();
+
+  cout << "Repair vs. restart in OCC "
+       << "(restarts, wasted time, p99 latency per txn)" << endl;
+  vector<CCMode> repair_modes = {OCC};
+
+  cout << "65% contention" << endl;
+  lg.push_back(new RMWLoadGen(100, 10, 10, 0.0001));
+  lg.push_back(new RMWLoadGen(100, 10, 10, 0.001));
+  lg.push_back(new RMWLoadGen(100, 10, 10, 0.01));
+  lg.push_back(new RMWLoadGen(100, 10, 10, 0.1));
+
+  cout << "  restart" << endl;
+  Benchmark(lg, repair_modes, true);
+  cout << "  repair" << endl;
+  Benchmark(lg, repair_modes, true, REPAIR);
+
+  for (uint32 i = 0; i < lg.size(); i++)
+    delete lg[i];
+  lg.clear();
+
+  cout << "100% contention" << endl;
+  lg.push_back(new RMWLoadGen(10, 0, 10, 0.0001));
+  lg.push_back(new RMWLoadGen(10, 0, 10, 0.001));
+  lg.push_back(new RMWLoadGen(10, 0, 10, 0.01));
+  lg.push_back(new RMWLoadGen(10, 0, 10, 0.1));
+
+  cout << "  restart" << endl;
+  Benchmark(lg, repair_modes, true);
+  cout << "  repair" << endl;
+  Benchmark(lg, repair_modes, true, REPAIR);
+
+  for (uint32 i = 0; i < lg.size(); i++)
+    delete lg[i];
+  lg.clear();
+
+  cout << "Retry queue in OCC and OCC-P (restarts, max restarts, wasted time, "
+       << "p99/p999 latency per txn)" << endl;
+
+  cout << "100% contention" << endl;
+  lg.push_back(new RMWLoadGen(10, 0, 10, 0.0001));
+  lg.push_back(new RMWLoadGen(10, 0, 10, 0.001));
+  lg.push_back(new RMWLoadGen(10, 0, 10, 0.01));
+  lg.push_back(new RMWLoadGen(10, 0, 10, 0.1));
+
+  cout << "  request queue" << endl;
+  Benchmark(lg, occ_modes, true);
+  cout << "  retry queue" << endl;
+  Benchmark(lg, occ_modes, true, RETRY_QUEUE);
+
+  for (uint32 i = 0; i < lg.size(); i++)
+    delete lg[i];
+  lg.clear();
+
+  cout << "Early lock release vs. locking (restarts, wasted time per txn)"
+       << endl;
+  vector<CCMode> bamboo_modes = {SERIAL, LOCKING_EXCLUSIVE_ONLY, LOCKING,
+                                 BAMBOO};
+
+  cout << "100% contention" << endl;
+  lg.push_back(new RMWLoadGen(10, 0, 10, 0.0001));
+  lg.push_back(new RMWLoadGen(10, 0, 10, 0.001));
+  lg.push_back(new RMWLoadGen(10, 0, 10, 0.01));
+  lg.push_back(new RMWLoadGen(10, 0, 10, 0.1));
+
+  Benchmark(lg, bamboo_modes, true);
+
+  for (uint32 i = 0; i < lg.size(); i++)
+    delete lg[i];
+  lg.clear();
+
+  cout << "100% contention, commutative increments" << endl;
+  lg.push_back(new IncrementLoadGen(10, 0, 10, 0.0001));
+  lg.push_back(new IncrementLoadGen(10, 0, 10, 0.001));
+  lg.push_back(new IncrementLoadGen(10, 0, 10, 0.01));
+  lg.push_back(new IncrementLoadGen(10, 0, 10, 0.1));
+
+  Benchmark(lg);
+
+  for (uint32 i = 0; i < lg.size(); i++)
+    delete lg[i];
+  lg.clear();
+
+  cout << "Single hot key, commutative increments" << endl;
+  lg.push_back(new IncrementLoadGen(1, 0, 1, 0.0001));
+  lg.push_back(new IncrementLoadGen(1, 0, 1, 0.001));
+  lg.push_back(new IncrementLoadGen(1, 0, 1, 0.01));
+  lg.push_back(new IncrementLoadGen(1, 0, 1, 0.1));
+
+  cout << "  joined" << endl;
+  Benchmark(lg);
+  cout << "  split" << endl;
+  Benchmark(lg, AllModes(), false, SPLIT_HOT_KEYS);
+
+  for (uint32 i = 0; i < lg.size(); i++)
+    delete lg[i];
+  lg.clear();
+
+  cout << "On-demand reads of large declared sets" << endl;
+  cout << "\t\t10 keys\t\t100 keys\t1000 keys" << endl;
+
+  cout << "Blind writes (Put)" << endl;
+  lg.push_back(new PutLoadGen(10000, 10));
+  lg.push_back(new PutLoadGen(10000, 100));
+  lg.push_back(new PutLoadGen(10000, 1000));
+
+  Benchmark(lg);
+
+  for (uint32 i = 0; i < lg.size(); i++)
+    delete lg[i];
+  lg.clear();
+
+  cout << "One key used (Pick)" << endl;
+  lg.push_back(new PickLoadGen(10000, 10, 0.0001));
+  lg.push_back(new PickLoadGen(10000, 100, 0.0001));
+  lg.push_back(new PickLoadGen(10000, 1000, 0.0001));
+
+  Benchmark(lg);
+
+  for (uint32 i = 0; i < lg.size(); i++)
+    delete lg[i];
+  lg.clear();
+
+  cout << "Out-of-stock Shopping" << endl;
+  cout << "\t\t0.1ms\t\t1ms" << endl;
+  lg.push_back(new ShoppingLoadGen(10000, 0.0001));
+  lg.push_back(new ShoppingLoadGen(10000, 0.001));
+
+  Benchmark(lg);
+
+  for (uint32 i = 0; i < lg.size(); i++)
+    delete lg[i];
+  lg.clear();
+
+  cout << "Read only, then 100% contention after 0.5s" << endl;
+  lg.push_back(new PhasedLoadGen(new RMWLoadGen(10000, 10, 0, 0.0001),
+                                 new RMWLoadGen(10, 0, 10, 0.0001), 0.5));
+  lg.push_back(new PhasedLoadGen(new RMWLoadGen(10000, 10, 0, 0.001),
+                                 new RMWLoadGen(10, 0, 10, 0.001), 0.5));
+  lg.push_back(new PhasedLoadGen(new RMWLoadGen(10000, 10, 0, 0.01),
+                                 new RMWLoadGen(10, 0, 10, 0.01), 0.5));
+  lg.push_back(new PhasedLoadGen(new RMWLoadGen(10000, 10, 0, 0.1),
+                                 new RMWLoadGen(10, 0, 10, 0.1), 0.5));
+
+  Benchmark(lg);
+
+  for (uint32 i = 0; i < lg.size(); i++)
+    delete lg[i];
+  lg.clear();
+
+  cout << "Skewed contention (10% of accesses to 20 hot keys)" << endl;
+  lg.push_back(new HotKeyLoadGen(10000, 20, 10, 10, 0.1, 0.0001));
+  lg.push_back(new HotKeyLoadGen(10000, 20, 10, 10, 0.1, 0.001));
+  lg.push_back(new HotKeyLoadGen(10000, 20, 10, 10, 0.1, 0.01));
+  lg.push_back(new HotKeyLoadGen(10000, 20, 10, 10, 0.1, 0.1));
+
+  Benchmark(lg);
+
+  for (uint32 i = 0; i < lg.size(); i++)
+    delete lg[i];
+  lg.clear();
+
+  if (argc > 1 && strcmp(argv[1], "--sweeps") == 0) {
+    WakeupBenchmark();
+    DeliveryBenchmark();
+    BatchBenchmark();
+    SessionBenchmark();
+    ThreadSweepBenchmark();
+  }
 }
 
@@ -51,12 +51,14 @@ class Expect : public Txn {
   map<Key, Value> m_;
 };
 
-// Inserts all pairs in the map 'm'.
+// Inserts all pairs in the map 'm', without reading them first.
 class Put : public Txn {
  public:
   Put(const map<Key, Value>& m) : m_(m) {
-    for (map<Key, Value>::iterator it = m_.begin(); it != m_.end(); ++it)
+    for (map<Key, Value>::iterator it = m_.begin(); it != m_.end(); ++it) {
       writeset_.insert(it->first);
+      blindset_.insert(it->first);
+    }
   }
 
   Put* clone() const {             // Virtual constructor (copying)
@@ -91,6 +93,59 @@ class RMW : public Txn {
   // Constructor with randomized read/write sets
   RMW(int dbsize, int readsetsize, int writesetsize, double time = 0)
       : time_(time) {
+    Randomize(dbsize, readsetsize, writesetsize);
+  }
+
+  // Recycles this txn (see 'Txn::Recycle()') as a new RMW with randomized
+  // read/write sets.
+  void Reuse(int dbsize, int readsetsize, int writesetsize, double time = 0) {
+    Recycle();
+    time_ = time;
+    Randomize(dbsize, readsetsize, writesetsize);
+  }
+
+  RMW* clone() const {             // Virtual constructor (copying)
+    RMW* clone = new RMW(time_);
+    this->CopyTxnInternals(clone);
+    return clone;
+  }
+
+  virtual void Run() {
+    Value result;
+    // Read everything in readset.
+    for (KeySet::iterator it = readset_.begin(); it != readset_.end(); ++it)
+      Read(*it, &result);
+
+    // Increment length of everything in writeset.
+    for (KeySet::iterator it = writeset_.begin(); it != writeset_.end();
+         ++it) {
+      result = 0;
+      Read(*it, &result);
+      Write(*it, result + 1);
+      Retire(*it);
+    }
+
+    // Wait a random amount of time (averaging time_) before committing.
+    Work(0.9 * time_ + RandomDouble(time_ * 0.2));
+    COMMIT;
+  }
+
+  // Only the increments of stale keys depend on what was read.
+  virtual bool Repair(const KeySet& stale) {
+    for (KeySet::const_iterator it = stale.begin(); it != stale.end();
+         ++it) {
+      if (writeset_.count(*it)) {
+        Value result = 0;
+        Read(*it, &result);
+        Write(*it, result + 1);
+      }
+    }
+    return true;
+  }
+
+ private:
+  // Chooses 'readsetsize' + 'writesetsize' unique random keys.
+  void Randomize(int dbsize, int readsetsize, int writesetsize) {
     // Make sure we can find enough unique keys.
     DCHECK(dbsize >= readsetsize + writesetsize);
 
@@ -113,28 +168,59 @@ class RMW : public Txn {
     }
   }
 
-  RMW* clone() const {             // Virtual constructor (copying)
-    RMW* clone = new RMW(time_);
+  double time_;
+};
+
+// Reads its readset, then adds one to every key in its deltaset using
+// commutative updates, which do not conflict with each other.
+class Increment : public Txn {
+ public:
+  explicit Increment(double time = 0) : time_(time) {}
+  Increment(const set<Key>& readset, const set<Key>& deltaset, double time = 0)
+      : time_(time) {
+    readset_ = readset;
+    deltaset_ = deltaset;
+  }
+
+  // Constructor with randomized read/delta sets
+  Increment(int dbsize, int readsetsize, int deltasetsize, double time = 0)
+      : time_(time) {
+    // Make sure we can find enough unique keys.
+    DCHECK(dbsize >= readsetsize + deltasetsize);
+
+    for (int i = 0; i < readsetsize; i++) {
+      Key key;
+      do {
+        key = rand() % dbsize;
+      } while (readset_.count(key));
+      readset_.insert(key);
+    }
+    for (int i = 0; i < deltasetsize; i++) {
+      Key key;
+      do {
+        key = rand() % dbsize;
+      } while (readset_.count(key) || deltaset_.count(key));
+      deltaset_.insert(key);
+    }
+  }
+
+  Increment* clone() const {             // Virtual constructor (copying)
+    Increment* clone = new Increment(time_);
     this->CopyTxnInternals(clone);
     return clone;
   }
 
   virtual void Run() {
     Value result;
-    // Read everything in readset.
-    for (set<Key>::iterator it = readset_.begin(); it != readset_.end(); ++it)
+    for (KeySet::iterator it = readset_.begin(); it != readset_.end(); ++it)
       Read(*it, &result);
-
-    // Increment length of everything in writeset.
-    for (set<Key>::iterator it = writeset_.begin(); it != writeset_.end();
+    for (KeySet::iterator it = deltaset_.begin(); it != deltaset_.end();
          ++it) {
-      result = 0;
-      Read(*it, &result);
-      Write(*it, result + 1);
+      Add(*it, 1);
     }
 
     // Wait a random amount of time (averaging time_) before committing.
-    Sleep(0.9 * time_ + RandomDouble(time_ * 0.2));
+    Work(0.9 * time_ + RandomDouble(time_ * 0.2));
     COMMIT;
   }
 
@@ -0,0 +1,86 @@
+/// @file
+///
+/// Bump allocator for objects that all die at the same time.
+///
+/// An Arena hands out memory from the end of its current block, and only
+/// goes to the heap when that block is full (for a new block at least twice
+/// as large). Nothing allocated from it is ever freed individually. Instead,
+/// Reset() releases everything at once, keeping the current block so that the
+/// next round of allocations of similar size needs no heap allocation at all.
+
+#ifndef _DB_UTILS_ARENA_H_
+#define _DB_UTILS_ARENA_H_
+
+#include <stddef.h>
+
+#include <algorithm>
+
+class Arena {
+ public:
+  // The first block is 'block_size' bytes, allocated on first use.
+  explicit Arena(size_t block_size = 4096)
+      : block_size_(block_size), block_(NULL), used_(0), capacity_(0) {}
+
+  ~Arena() {
+    Reset();
+    delete[] block_;
+  }
+
+  // Returns 'size' bytes of memory, suitably aligned for any type, that
+  // remain valid until the next Reset() or the Arena's destruction.
+  void* Allocate(size_t size) {
+    size = (size + kAlignment - 1) & ~(kAlignment - 1);
+    if (used_ + size > capacity_)
+      Grow(size);
+    void* result = block_ + used_;
+    used_ += size;
+    return result;
+  }
+
+  // Releases everything allocated so far. Only the current block is kept.
+  void Reset() {
+    if (block_ == NULL)
+      return;
+    char* previous = Previous(block_);
+    while (previous != NULL) {
+      char* next = Previous(previous);
+      delete[] previous;
+      previous = next;
+    }
+    Previous(block_) = NULL;
+    used_ = kAlignment;
+  }
+
+ private:
+  // Arenas own their blocks, so they cannot be copied.
+  Arena(const Arena&);
+  Arena& operator=(const Arena&);
+
+  static const size_t kAlignment = 16;
+
+  // Each block starts with a pointer to the block used before it.
+  static char*& Previous(char* block) {
+    return *reinterpret_cast<char**>(block);
+  }
+
+  // Starts a new block with room for at least 'size' bytes.
+  void Grow(size_t size) {
+    capacity_ = std::max(std::max(block_size_, 2 * capacity_),
+                         size + kAlignment);
+    char* block = new char[capacity_];
+    Previous(block) = block_;
+    block_ = block;
+    used_ = kAlignment;
+  }
+
+  // Size of the first block.
+  size_t block_size_;
+
+  // Block currently being allocated from (NULL until first use), and how
+  // much of it is in use (including the link to the previous block).
+  char* block_;
+  size_t used_;
+  size_t capacity_;
+};
+
+#endif  // _DB_UTILS_ARENA_H_
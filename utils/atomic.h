@@ -28,6 +28,9 @@
 #define _DB_UTILS_ATOMIC_H_
 
 #include <assert.h>
+#include <stdint.h>
+
+#include <atomic>
 #include <queue>
 #include <tr1/unordered_map>
 
@@ -101,18 +104,18 @@ class AtomicMap {
   MutexRW mutex_;
 };
 
-/// @class AtomicQueue<T>
+/// @class LockedQueue<T>
 ///
-/// Queue with atomic push and pop operations.
-///
-/// @TODO(alex): This should use lower-contention synchronization.
+/// Queue with atomic push and pop operations, implemented as a std::queue
+/// guarded by a mutex. AtomicQueue falls back on one of these when it runs
+/// out of room.
 template<typename T>
-class AtomicQueue {
+class LockedQueue {
  public:
-  AtomicQueue() {}
+  LockedQueue() {}
 
   // Returns the number of elements currently in the queue.
-  void Size() {
+  int Size() {
     mutex_.Lock();
     int size = queue_.size();
     mutex_.Unlock();
@@ -177,6 +180,186 @@ class AtomicQueue {
   Mutex mutex_;
 };
 
+/// @class AtomicQueue<T>
+///
+/// Lock-free multi-producer, multi-consumer queue with atomic push and pop
+/// operations.
+///
+/// Elements live in a fixed ring of cells, each tagged with a sequence number
+/// that says whether the cell is ready to be written or read for a given
+/// position (D. Vyukov's bounded MPMC queue). Producers and consumers each
+/// claim positions with a single CAS, and only touch the cells they claimed,
+/// so neither side ever waits for a lock. Batched operations claim several
+/// adjacent positions with one CAS.
+///
+/// The queue is unbounded: once the ring is full, pushes go to a LockedQueue
+/// instead, and keep going there until consumers have emptied it, so that
+/// elements are still popped in the order they were pushed.
+template<typename T>
+class AtomicQueue {
+ public:
+  // The ring holds 'capacity' elements, which must be a power of two.
+  explicit AtomicQueue(int capacity = 1024)
+      : cells_(new Cell[capacity]), mask_(capacity - 1), enqueue_pos_(0),
+        dequeue_pos_(0), overflow_size_(0) {
+    for (int i = 0; i < capacity; i++)
+      cells_[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  ~AtomicQueue() {
+    delete[] cells_;
+  }
+
+  // Returns the number of elements currently in the queue. The result is only
+  // approximate while other threads are pushing or popping.
+  int Size() {
+    uint64_t enqueued = enqueue_pos_.load(std::memory_order_relaxed);
+    uint64_t dequeued = dequeue_pos_.load(std::memory_order_relaxed);
+    int size = enqueued > dequeued ? enqueued - dequeued : 0;
+    return size + overflow_size_.load(std::memory_order_relaxed);
+  }
+
+  // Atomically pushes 'item' onto the queue.
+  void Push(const T& item) {
+    PushBatch(&item, 1);
+  }
+
+  // If the queue is non-empty, (atomically) sets '*result' equal to the front
+  // element, pops the front element from the queue, and returns true,
+  // otherwise returns false.
+  bool Pop(T* result) {
+    return PopBatch(result, 1) == 1;
+  }
+
+  // Pushes 'items[0..n-1]' onto the queue, in order. Elements pushed
+  // concurrently by other threads may be interleaved with them.
+  void PushBatch(const T* items, int n) {
+    while (n > 0) {
+      int pushed = 0;
+      if (overflow_size_.load(std::memory_order_acquire) == 0)
+        pushed = PushRing(items, n);
+      if (pushed == 0) {
+        // Counted first, so that it never looks like less than is there.
+        overflow_size_.fetch_add(1, std::memory_order_release);
+        overflow_.Push(*items);
+        pushed = 1;
+      }
+      items += pushed;
+      n -= pushed;
+    }
+  }
+
+  // Pops up to 'max' elements from the front of the queue into 'results',
+  // and returns how many were popped.
+  int PopBatch(T* results, int max) {
+    int popped = PopRing(results, max);
+    while (popped < max && overflow_size_.load(std::memory_order_acquire) > 0 &&
+           overflow_.Pop(&results[popped])) {
+      overflow_size_.fetch_sub(1, std::memory_order_release);
+      popped++;
+    }
+    return popped;
+  }
+
+  // Same as 'Push(item)'; pushing never has to wait.
+  bool PushNonBlocking(const T& item) {
+    Push(item);
+    return true;
+  }
+
+  // Same as 'Pop(result)'; popping never has to wait.
+  bool PopNonBlocking(T* result) {
+    return Pop(result);
+  }
+
+ private:
+  struct Cell {
+    // Position this cell is ready to be written for (seq == pos) or read
+    // for (seq == pos + 1).
+    std::atomic<uint64_t> seq;
+    T data;
+  };
+
+  // Claims up to 'n' adjacent free cells, writes 'items' into them and
+  // returns how many it wrote (0 if the ring is full).
+  int PushRing(const T* items, int n) {
+    uint64_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    while (true) {
+      int free = 0;
+      while (free < n && free <= static_cast<int>(mask_) &&
+             cells_[(pos + free) & mask_].seq.load(std::memory_order_acquire)
+                 == pos + free) {
+        free++;
+      }
+      if (free == 0) {
+        uint64_t seq = cells_[pos & mask_].seq.load(std::memory_order_acquire);
+        if (seq < pos)
+          return 0;  // Full.
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+        continue;
+      }
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + free,
+                                             std::memory_order_relaxed)) {
+        for (int i = 0; i < free; i++) {
+          Cell* cell = &cells_[(pos + i) & mask_];
+          cell->data = items[i];
+          cell->seq.store(pos + i + 1, std::memory_order_release);
+        }
+        return free;
+      }
+    }
+  }
+
+  // Claims up to 'max' adjacent full cells, reads them into 'results' and
+  // returns how many it read (0 if the ring is empty).
+  int PopRing(T* results, int max) {
+    uint64_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    while (true) {
+      int full = 0;
+      while (full < max && full <= static_cast<int>(mask_) &&
+             cells_[(pos + full) & mask_].seq.load(std::memory_order_acquire)
+                 == pos + full + 1) {
+        full++;
+      }
+      if (full == 0) {
+        uint64_t seq = cells_[pos & mask_].seq.load(std::memory_order_acquire);
+        if (seq < pos + 1)
+          return 0;  // Empty.
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+        continue;
+      }
+      if (dequeue_pos_.compare_exchange_weak(pos, pos + full,
+                                             std::memory_order_relaxed)) {
+        for (int i = 0; i < full; i++) {
+          Cell* cell = &cells_[(pos + i) & mask_];
+          results[i] = cell->data;
+          cell->seq.store(pos + i + mask_ + 1, std::memory_order_release);
+        }
+        return full;
+      }
+    }
+  }
+
+  Cell* cells_;
+  uint64_t mask_;
+
+  // Next positions to write and read. Padding keeps producers and consumers
+  // from invalidating each other's cache lines.
+  char enqueue_padding_[64];
+  std::atomic<uint64_t> enqueue_pos_;
+  char dequeue_padding_[64];
+  std::atomic<uint64_t> dequeue_pos_;
+  char overflow_padding_[64];
+
+  // Elements pushed while the ring was full, and how many of them there are.
+  LockedQueue<T> overflow_;
+  std::atomic<int> overflow_size_;
+
+  // Queues are shared by address, so they cannot be copied.
+  AtomicQueue(const AtomicQueue&);
+  AtomicQueue& operator=(const AtomicQueue&);
+};
+
 // An atomically modifiable object. T is required to be a simple numeric type
 // or simple struct.
 template<typename T>
@@ -0,0 +1,169 @@
+#include "utils/atomic.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+#include <vector>
+
+#include "txn/common.h"
+#include "utils/testing.h"
+
+// Has 'producers' threads push the integers 1 to 'count' onto a queue while
+// 'consumers' threads pop them, 'batch' at a time.
+template<typename Queue>
+class QueueStress {
+ public:
+  QueueStress(Queue* queue, int producers, int consumers, int count,
+              int batch)
+      : queue_(queue), producers_(producers), consumers_(consumers),
+        count_(count), batch_(batch), next_producer_(0), popped_(0),
+        sum_(0) {}
+
+  // Returns the sum of the integers popped, and sets '*seconds' to how long
+  // it took to pass them all through the queue.
+  uint64 Run(double* seconds) {
+    vector<pthread_t> threads(producers_ + consumers_);
+    double start = GetTime();
+    for (int i = 0; i < producers_ + consumers_; i++) {
+      pthread_create(&threads[i], NULL,
+                     i < producers_ ? RunProducer : RunConsumer, this);
+    }
+    for (uint32 i = 0; i < threads.size(); i++)
+      pthread_join(threads[i], NULL);
+    *seconds = GetTime() - start;
+    return sum_;
+  }
+
+ private:
+  static void* RunProducer(void* arg) {
+    QueueStress* q = reinterpret_cast<QueueStress*>(arg);
+    int id = q->next_producer_++;
+    vector<uint64> items;
+    for (uint64 item = id + 1; item <= static_cast<uint64>(q->count_);
+         item += q->producers_) {
+      items.push_back(item);
+      if (static_cast<int>(items.size()) == q->batch_) {
+        q->Push(items);
+        items.clear();
+      }
+    }
+    q->Push(items);
+    return NULL;
+  }
+
+  static void* RunConsumer(void* arg) {
+    QueueStress* q = reinterpret_cast<QueueStress*>(arg);
+    vector<uint64> items(q->batch_);
+    uint64 sum = 0;
+    while (q->popped_ < q->count_) {
+      int n = q->Pop(&items);
+      if (n == 0) {
+        sched_yield();
+        continue;
+      }
+      for (int i = 0; i < n; i++)
+        sum += items[i];
+      q->popped_ += n;
+    }
+    q->sum_ += sum;
+    return NULL;
+  }
+
+  void Push(const vector<uint64>& items);
+  int Pop(vector<uint64>* items);
+
+  Queue* queue_;
+  int producers_;
+  int consumers_;
+  int count_;
+  int batch_;
+  std::atomic<int> next_producer_;
+  std::atomic<int> popped_;
+  std::atomic<uint64> sum_;
+};
+
+// LockedQueues have no batched operations.
+template<>
+void QueueStress<LockedQueue<uint64> >::Push(const vector<uint64>& items) {
+  for (uint32 i = 0; i < items.size(); i++)
+    queue_->Push(items[i]);
+}
+template<>
+int QueueStress<LockedQueue<uint64> >::Pop(vector<uint64>* items) {
+  return queue_->Pop(&(*items)[0]) ? 1 : 0;
+}
+
+template<>
+void QueueStress<AtomicQueue<uint64> >::Push(const vector<uint64>& items) {
+  if (!items.empty())
+    queue_->PushBatch(&items[0], items.size());
+}
+template<>
+int QueueStress<AtomicQueue<uint64> >::Pop(vector<uint64>* items) {
+  return queue_->PopBatch(&(*items)[0], items->size());
+}
+
+TEST(AtomicQueue_Order) {
+  // A ring of 4 overflows, but elements still come out in order.
+  AtomicQueue<int> q(4);
+  int items[10] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+  q.Push(items[0]);
+  q.PushBatch(items + 1, 9);
+  EXPECT_EQ(10, q.Size());
+
+  int result[10];
+  EXPECT_TRUE(q.Pop(result));
+  EXPECT_EQ(0, result[0]);
+  EXPECT_EQ(3, q.PopBatch(result, 3));
+  EXPECT_EQ(3, result[2]);
+  EXPECT_EQ(6, q.PopBatch(result, 10));
+  for (int i = 0; i < 6; i++)
+    EXPECT_EQ(4 + i, result[i]);
+  EXPECT_FALSE(q.Pop(result));
+  EXPECT_EQ(0, q.Size());
+
+  // Everything pushed concurrently is popped exactly once.
+  AtomicQueue<uint64> shared(64);
+  double seconds;
+  EXPECT_EQ(100000ULL * 100001 / 2,
+            QueueStress<AtomicQueue<uint64> >(
+                &shared, 4, 4, 100000, 8).Run(&seconds));
+  EXPECT_EQ(0, shared.Size());
+
+  END;
+}
+
+// Passes 1M integers from 1 to 64 producer threads to as many consumer
+// threads, through a LockedQueue and through an AtomicQueue (one at a time
+// and in batches of 16), printing operations (pushes + pops) per second.
+void QueueBenchmark() {
+  cout << "Queue throughput (ops/s)" << endl;
+  cout << "threads\t\tlocked\t\tatomic\t\tatomic, batch 16" << endl;
+  for (int threads = 1; threads <= 64; threads *= 2) {
+    double seconds;
+    cout << threads << flush;
+
+    LockedQueue<uint64> locked;
+    QueueStress<LockedQueue<uint64> >(
+        &locked, threads, threads, 1000000, 1).Run(&seconds);
+    cout << "\t\t" << 2000000 / seconds << flush;
+
+    AtomicQueue<uint64> atomic;
+    QueueStress<AtomicQueue<uint64> >(
+        &atomic, threads, threads, 1000000, 1).Run(&seconds);
+    cout << "\t\t" << 2000000 / seconds << flush;
+
+    QueueStress<AtomicQueue<uint64> >(
+        &atomic, threads, threads, 1000000, 16).Run(&seconds);
+    cout << "\t\t" << 2000000 / seconds << endl;
+  }
+}
+
+// Runs the tests, and the benchmark too if given '--bench'.
+int main(int argc, char** argv) {
+  AtomicQueue_Order();
+
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+    QueueBenchmark();
+}
@@ -0,0 +1,196 @@
+/// @file
+///
+/// The CPUs this process may run on, grouped into physical cores and packages
+/// as described by sysfs (/sys/devices/system/cpu, Linux only), and pinning
+/// threads to them.
+///
+/// Thread pools use this to spread workers over physical cores before
+/// doubling up on a core's hyperthreads, and to keep a busy thread (such as a
+/// scheduler loop) on a core of its own.
+
+#ifndef _DB_UTILS_CPU_TOPOLOGY_H_
+#define _DB_UTILS_CPU_TOPOLOGY_H_
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+using std::vector;
+
+class CpuTopology {
+ public:
+  // Reads the topology of the CPUs in the calling thread's affinity mask
+  // (which it inherits from the process, so it honors cpusets and taskset).
+  // If the mask cannot be read, uses the online CPUs instead; if sysfs cannot
+  // be read either, assumes CPUs 0 to sysconf(_SC_NPROCESSORS_ONLN) - 1. CPUs
+  // whose topology sysfs does not describe each count as a core of their own.
+  CpuTopology() {
+    vector<int> online = AllowedCpus();
+    if (online.empty())
+      online = ReadList("/sys/devices/system/cpu/online");
+    if (online.empty()) {
+      for (int i = 0; i < sysconf(_SC_NPROCESSORS_ONLN); i++)
+        online.push_back(i);
+    }
+    for (size_t i = 0; i < online.size(); i++) {
+      Cpu cpu;
+      cpu.id = online[i];
+      cpu.package = ReadInt(online[i], "physical_package_id", 0);
+      cpu.core = ReadInt(online[i], "core_id", online[i]);
+      cpus_.push_back(cpu);
+    }
+
+    // Number each CPU's position among the CPUs of its core, so that
+    // sorting by it puts the first hyperthread of every core first.
+    for (size_t i = 0; i < cpus_.size(); i++) {
+      cpus_[i].thread = 0;
+      for (size_t j = 0; j < i; j++) {
+        if (SameCore(cpus_[i], cpus_[j]))
+          cpus_[i].thread++;
+      }
+    }
+    std::sort(cpus_.begin(), cpus_.end(), SpreadOrder);
+  }
+
+  // Returns the CPUs, ordered so that every physical core appears
+  // once before any core appears a second time (as another hyperthread), and
+  // the cores of each package are adjacent.
+  vector<int> Cpus() const {
+    vector<int> ids;
+    for (size_t i = 0; i < cpus_.size(); i++)
+      ids.push_back(cpus_[i].id);
+    return ids;
+  }
+
+  // Returns the number of physical cores with any of the CPUs.
+  int Cores() const {
+    int cores = 0;
+    for (size_t i = 0; i < cpus_.size(); i++)
+      cores += cpus_[i].thread == 0;
+    return cores;
+  }
+
+  // Returns true if CPUs 'a' and 'b' are hyperthreads of the same physical
+  // core (or are the same CPU).
+  bool SameCore(int a, int b) const {
+    const Cpu* x = Find(a);
+    const Cpu* y = Find(b);
+    return x != NULL && y != NULL && SameCore(*x, *y);
+  }
+
+ private:
+  struct Cpu {
+    int id;
+    int package;
+    int core;
+    int thread;  // Position among the CPUs of its core.
+  };
+
+  static bool SameCore(const Cpu& a, const Cpu& b) {
+    return a.package == b.package && a.core == b.core;
+  }
+
+  static bool SpreadOrder(const Cpu& a, const Cpu& b) {
+    if (a.thread != b.thread)
+      return a.thread < b.thread;
+    if (a.package != b.package)
+      return a.package < b.package;
+    if (a.core != b.core)
+      return a.core < b.core;
+    return a.id < b.id;
+  }
+
+  const Cpu* Find(int id) const {
+    for (size_t i = 0; i < cpus_.size(); i++) {
+      if (cpus_[i].id == id)
+        return &cpus_[i];
+    }
+    return NULL;
+  }
+
+  // Returns the CPUs in the calling thread's affinity mask, or an empty list
+  // if it cannot be read.
+  static vector<int> AllowedCpus() {
+    vector<int> list;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0)
+      return list;
+    for (int i = 0; i < CPU_SETSIZE; i++) {
+      if (CPU_ISSET(i, &set))
+        list.push_back(i);
+    }
+    return list;
+  }
+
+  // Reads a CPU list such as "0-3,8,10-11" from 'path'. Returns an empty
+  // list if the file cannot be read.
+  static vector<int> ReadList(const char* path) {
+    vector<int> list;
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+      return list;
+    int first, last;
+    while (fscanf(file, "%d", &first) == 1) {
+      last = first;
+      int c = fgetc(file);
+      if (c == '-') {
+        if (fscanf(file, "%d", &last) != 1)
+          break;
+        c = fgetc(file);
+      }
+      for (int i = first; i <= last; i++)
+        list.push_back(i);
+      if (c != ',')
+        break;
+    }
+    fclose(file);
+    return list;
+  }
+
+  // Reads /sys/devices/system/cpu/cpu<cpu>/topology/<name>, or returns
+  // 'fallback' if it cannot be read.
+  static int ReadInt(int cpu, const char* name, int fallback) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s",
+             cpu, name);
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+      return fallback;
+    int value;
+    if (fscanf(file, "%d", &value) != 1)
+      value = fallback;
+    fclose(file);
+    return value;
+  }
+
+  vector<Cpu> cpus_;
+};
+
+// Restricts 'thread' to running on CPU 'cpu'. Returns false if that is not
+// possible (e.g. the CPU is offline or outside the process's allowed set),
+// in which case 'thread' is left as it was. The first such failure in the
+// process is reported on stderr.
+inline bool PinThread(pthread_t thread, int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  int error = pthread_setaffinity_np(thread, sizeof(set), &set);
+  if (error == 0)
+    return true;
+
+  static std::atomic<bool> reported(false);
+  if (!reported.exchange(true)) {
+    fprintf(stderr, "Could not pin a thread to CPU %d (%s); leaving it "
+            "unpinned.\n", cpu, strerror(error));
+  }
+  return false;
+}
+
+#endif  // _DB_UTILS_CPU_TOPOLOGY_H_
@@ -0,0 +1,132 @@
+/// @file
+///
+/// Lets threads that run out of work sleep until another thread hands them
+/// more, without the thread handing it over paying for a system call unless
+/// someone is actually asleep.
+///
+/// A consumer that finds nothing to do calls PrepareWait(), checks for work
+/// once more, and then either calls CancelWait() (if it found some after all)
+/// or Wait() with the key PrepareWait() returned. A producer calls Notify()
+/// after making work available. If the Notify() comes after PrepareWait(),
+/// Wait() returns promptly; if it comes before, the consumer's second check
+/// sees the work. Either way, no wakeup is lost.
+///
+/// Wait() first spins for a while, since new work often arrives within a few
+/// microseconds, and only then parks the thread on a futex (Linux only). The
+/// spin length adapts: it doubles whenever spinning was enough, and halves
+/// whenever the thread had to park anyway.
+
+#ifndef _DB_UTILS_EVENT_COUNT_H_
+#define _DB_UTILS_EVENT_COUNT_H_
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+
+class EventCount {
+ public:
+  EventCount() : epoch_(0), waiters_(0), sleepers_(0), spin_(kMinSpin) {}
+
+  // Registers the calling thread as about to wait, and returns the key to
+  // pass to 'Wait()'. Must be followed by exactly one call to 'Wait()' or
+  // 'CancelWait()'.
+  uint32_t PrepareWait() {
+    waiters_.fetch_add(1, std::memory_order_seq_cst);
+    return epoch_.load(std::memory_order_seq_cst);
+  }
+
+  // Undoes 'PrepareWait()' without waiting.
+  void CancelWait() {
+    waiters_.fetch_sub(1, std::memory_order_seq_cst);
+  }
+
+  // Waits until 'Notify()' is called after the 'PrepareWait()' that returned
+  // 'key', or until 'timeout' seconds have passed (forever if 'timeout' is
+  // negative). Returns true if notified. May also return early for no reason,
+  // so callers must check for work again either way.
+  bool Wait(uint32_t key, double timeout) {
+    bool notified = Spin(key) || Park(key, timeout);
+    waiters_.fetch_sub(1, std::memory_order_seq_cst);
+    return notified;
+  }
+
+  // Wakes one waiting thread, if there is any.
+  void Notify() {
+    Signal(1);
+  }
+
+  // Wakes every waiting thread.
+  void NotifyAll() {
+    Signal(INT_MAX);
+  }
+
+ private:
+  // Bounds on the number of times 'Spin()' polls 'epoch_'.
+  static const int kMinSpin = 16;
+  static const int kMaxSpin = 1024;
+
+  void Signal(int count) {
+    // Pairs with 'PrepareWait()': either this sees the waiter, or the
+    // waiter's second check sees the producer's work.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters_.load(std::memory_order_relaxed) == 0)
+      return;
+    epoch_.fetch_add(1, std::memory_order_seq_cst);
+    if (sleepers_.load(std::memory_order_seq_cst) > 0) {
+      syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch_),
+              FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+    }
+  }
+
+  // Polls 'epoch_' for a change from 'key', for up to 'spin_' iterations.
+  bool Spin(uint32_t key) {
+    int spin = spin_.load(std::memory_order_relaxed);
+    for (int i = 0; i < spin; i++) {
+      if (epoch_.load(std::memory_order_acquire) != key) {
+        if (spin < kMaxSpin)
+          spin_.store(2 * spin, std::memory_order_relaxed);
+        return true;
+      }
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#endif
+    }
+    if (spin > kMinSpin)
+      spin_.store(spin / 2, std::memory_order_relaxed);
+    return false;
+  }
+
+  // Sleeps until 'epoch_' changes from 'key' or 'timeout' seconds pass.
+  bool Park(uint32_t key, double timeout) {
+    struct timespec ts;
+    ts.tv_sec = static_cast<time_t>(timeout);
+    ts.tv_nsec = static_cast<long>((timeout - ts.tv_sec) * 1e9);
+    sleepers_.fetch_add(1, std::memory_order_seq_cst);
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch_),
+            FUTEX_WAIT_PRIVATE, key, timeout < 0 ? NULL : &ts, NULL, 0);
+    sleepers_.fetch_sub(1, std::memory_order_seq_cst);
+    return epoch_.load(std::memory_order_acquire) != key;
+  }
+
+  // Bumped by every 'Notify()' that finds a waiter. The futex word.
+  std::atomic<uint32_t> epoch_;
+
+  // Threads between 'PrepareWait()' and the end of 'Wait()', and those of
+  // them currently parked.
+  std::atomic<int> waiters_;
+  std::atomic<int> sleepers_;
+
+  // Current spin length (see above).
+  std::atomic<int> spin_;
+
+  // Waiters sleep on this object's address, so it cannot be copied.
+  EventCount(const EventCount&);
+  EventCount& operator=(const EventCount&);
+};
+
+#endif  // _DB_UTILS_EVENT_COUNT_H_
@@ -0,0 +1,287 @@
+/// @file
+///
+/// Sorted set and map containers that keep their elements in one contiguous
+/// array, the first N of them inline.
+///
+/// Txns typically access 10-20 keys. In a std::set or std::map, each of those
+/// keys costs a heap allocation, and every lookup or scan chases pointers from
+/// node to node. FlatSet and FlatMap instead keep their elements sorted in a
+/// SmallVector, so a txn of typical size needs no allocation at all, lookups
+/// are binary searches and iteration walks a single array. Inserting or
+/// erasing shifts the elements after it, which is cheap at these sizes.
+///
+/// Iterators are plain pointers, and are invalidated by any insertion or
+/// erasure. Elements must be plain data, which is copied with '=' and needs
+/// no destruction (e.g. keys, values and pairs of them).
+///
+/// A container may be given an Arena, from which it then takes any storage
+/// beyond its inline elements, so that whoever owns the Arena can release
+/// that storage in one step.
+
+#ifndef _DB_UTILS_FLAT_SET_H_
+#define _DB_UTILS_FLAT_SET_H_
+
+#include <algorithm>
+#include <initializer_list>
+#include <set>
+#include <utility>
+
+#include "utils/arena.h"
+
+/// @class SmallVector<T, N>
+///
+/// Growable array that stores up to N elements inline and moves to the heap
+/// (or its Arena) beyond that. Clearing it keeps whatever capacity it has.
+template<typename T, int N>
+class SmallVector {
+ public:
+  typedef T* iterator;
+  typedef const T* const_iterator;
+
+  SmallVector() : data_(inline_), size_(0), capacity_(N), arena_(NULL) {}
+  SmallVector(const SmallVector& other)
+      : data_(inline_), size_(0), capacity_(N), arena_(NULL) {
+    *this = other;
+  }
+  ~SmallVector() {
+    if (data_ != inline_ && arena_ == NULL)
+      delete[] data_;
+  }
+
+  // Takes any storage beyond the inline elements from '*arena' from now on.
+  // The arena must outlive the vector, and must not be reset while the vector
+  // uses it (see 'Reset()').
+  void UseArena(Arena* arena) {
+    Reset();
+    arena_ = arena;
+  }
+
+  // Empties the vector and returns it to its inline storage.
+  void Reset() {
+    if (data_ != inline_ && arena_ == NULL)
+      delete[] data_;
+    data_ = inline_;
+    size_ = 0;
+    capacity_ = N;
+  }
+
+  SmallVector& operator=(const SmallVector& other) {
+    if (this != &other) {
+      Reserve(other.size_);
+      std::copy(other.begin(), other.end(), data_);
+      size_ = other.size_;
+    }
+    return *this;
+  }
+
+  iterator begin() { return data_; }
+  iterator end() { return data_ + size_; }
+  const_iterator begin() const { return data_; }
+  const_iterator end() const { return data_ + size_; }
+
+  int size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  void clear() { size_ = 0; }
+
+  T& back() { return data_[size_ - 1]; }
+  const T& back() const { return data_[size_ - 1]; }
+
+  // Makes room for at least 'capacity' elements, at least doubling the
+  // current capacity if it has to grow.
+  void Reserve(int capacity) {
+    if (capacity <= capacity_)
+      return;
+    capacity = std::max(capacity, 2 * capacity_);
+    T* data = arena_ == NULL ? new T[capacity] : static_cast<T*>(
+        arena_->Allocate(capacity * sizeof(T)));
+    std::copy(begin(), end(), data);
+    if (data_ != inline_ && arena_ == NULL)
+      delete[] data_;
+    data_ = data;
+    capacity_ = capacity;
+  }
+
+  void push_back(const T& t) {
+    Reserve(size_ + 1);
+    data_[size_++] = t;
+  }
+
+  // Inserts 't' before 'pos' and returns its position.
+  iterator insert(iterator pos, const T& t) {
+    int i = pos - data_;
+    Reserve(size_ + 1);
+    std::copy_backward(data_ + i, data_ + size_, data_ + size_ + 1);
+    data_[i] = t;
+    size_++;
+    return data_ + i;
+  }
+
+  void erase(iterator pos) {
+    std::copy(pos + 1, end(), pos);
+    size_--;
+  }
+
+ private:
+  T inline_[N];
+  T* data_;
+  int size_;
+  int capacity_;
+  Arena* arena_;
+};
+
+/// @class FlatSet<T, N>
+///
+/// Sorted set with the subset of std::set's interface that txns use.
+template<typename T, int N>
+class FlatSet {
+ public:
+  typedef const T* iterator;
+  typedef const T* const_iterator;
+
+  FlatSet() {}
+  FlatSet(std::initializer_list<T> elements) {
+    for (const T* it = elements.begin(); it != elements.end(); ++it)
+      insert(*it);
+  }
+  FlatSet(const std::set<T>& elements) {
+    elements_.Reserve(elements.size());
+    for (typename std::set<T>::const_iterator it = elements.begin();
+         it != elements.end(); ++it) {
+      elements_.push_back(*it);
+    }
+  }
+
+  iterator begin() const { return elements_.begin(); }
+  iterator end() const { return elements_.end(); }
+
+  int size() const { return elements_.size(); }
+  bool empty() const { return elements_.empty(); }
+  void clear() { elements_.clear(); }
+
+  // See 'SmallVector'.
+  void UseArena(Arena* arena) { elements_.UseArena(arena); }
+  void Reset() { elements_.Reset(); }
+
+  iterator find(const T& t) const {
+    iterator it = std::lower_bound(begin(), end(), t);
+    return (it != end() && *it == t) ? it : end();
+  }
+
+  int count(const T& t) const { return find(t) != end(); }
+
+  // Inserts 't' unless it is already present. Returns true if it was
+  // inserted. Inserting in ascending order only ever appends.
+  bool insert(const T& t) {
+    if (elements_.empty() || elements_.back() < t) {
+      elements_.push_back(t);
+      return true;
+    }
+    T* it = std::lower_bound(elements_.begin(), elements_.end(), t);
+    if (*it == t)
+      return false;
+    elements_.insert(it, t);
+    return true;
+  }
+
+  template<typename InputIterator>
+  void insert(InputIterator first, InputIterator last) {
+    for (; first != last; ++first)
+      insert(*first);
+  }
+
+  // Removes 't' if present. Returns the number of elements removed.
+  int erase(const T& t) {
+    iterator it = find(t);
+    if (it == end())
+      return 0;
+    elements_.erase(const_cast<T*>(it));
+    return 1;
+  }
+
+ private:
+  SmallVector<T, N> elements_;
+};
+
+/// @class FlatMap<K, V, N>
+///
+/// Sorted map with the subset of std::map's interface that txns use. V must
+/// be default-constructible.
+template<typename K, typename V, int N>
+class FlatMap {
+ public:
+  typedef std::pair<K, V> value_type;
+  typedef value_type* iterator;
+  typedef const value_type* const_iterator;
+
+  iterator begin() { return entries_.begin(); }
+  iterator end() { return entries_.end(); }
+  const_iterator begin() const { return entries_.begin(); }
+  const_iterator end() const { return entries_.end(); }
+
+  int size() const { return entries_.size(); }
+  bool empty() const { return entries_.empty(); }
+  void clear() { entries_.clear(); }
+
+  // See 'SmallVector'.
+  void UseArena(Arena* arena) { entries_.UseArena(arena); }
+  void Reset() { entries_.Reset(); }
+
+  iterator find(const K& key) {
+    iterator it = LowerBound(key);
+    return (it != end() && it->first == key) ? it : end();
+  }
+  const_iterator find(const K& key) const {
+    return const_cast<FlatMap*>(this)->find(key);
+  }
+
+  int count(const K& key) const { return find(key) != end(); }
+
+  // Returns the value mapped to 'key', inserting a default one first if
+  // there is none.
+  V& operator[](const K& key) {
+    iterator it = LowerBound(key);
+    if (it == end() || it->first != key)
+      it = entries_.insert(it, value_type(key, V()));
+    return it->second;
+  }
+
+  // Inserts 'entry' unless its key is already present. Returns the position
+  // of the entry with that key, and whether it was inserted.
+  std::pair<iterator, bool> insert(const value_type& entry) {
+    iterator it = LowerBound(entry.first);
+    if (it != end() && it->first == entry.first)
+      return std::make_pair(it, false);
+    return std::make_pair(entries_.insert(it, entry), true);
+  }
+
+  // Removes the entry with key 'key' if present. Returns the number of
+  // entries removed.
+  int erase(const K& key) {
+    iterator it = find(key);
+    if (it == end())
+      return 0;
+    entries_.erase(it);
+    return 1;
+  }
+
+ private:
+  // Returns the first entry whose key is not less than 'key'.
+  iterator LowerBound(const K& key) {
+    iterator lo = begin();
+    int len = size();
+    while (len > 0) {
+      int half = len / 2;
+      if (lo[half].first < key) {
+        lo += half + 1;
+        len -= half + 1;
+      } else {
+        len = half;
+      }
+    }
+    return lo;
+  }
+
+  SmallVector<value_type, N> entries_;
+};
+
+#endif  // _DB_UTILS_FLAT_SET_H_
@@ -0,0 +1,206 @@
+/// @file
+///
+/// Queues for handing results from a fixed set of worker threads to a single
+/// consumer (e.g. a scheduler thread).
+///
+/// With one shared multi-producer queue, every worker that finishes a task
+/// writes to the same cache lines, and they all bounce between cores. A
+/// FanInQueue instead gives each worker its own SpscRing, which only that
+/// worker writes to and only the consumer reads from. The consumer polls the
+/// rings round-robin and drains several elements from each at a time.
+
+#ifndef _DB_UTILS_SPSC_RING_H_
+#define _DB_UTILS_SPSC_RING_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <vector>
+
+#include "utils/atomic.h"
+
+/// @class SpscRing<T>
+///
+/// Bounded lock-free queue for exactly one producer thread and one consumer
+/// thread (which may be the same thread). Each side keeps a cached copy of
+/// the other side's position, so it only reads the other side's cache line
+/// when the ring looks full (to the producer) or empty (to the consumer).
+template<typename T>
+class SpscRing {
+ public:
+  // The ring holds 'capacity' elements, which must be a power of two.
+  explicit SpscRing(int capacity = 256)
+      : cells_(new T[capacity]), mask_(capacity - 1), head_(0),
+        cached_tail_(0), tail_(0), cached_head_(0) {}
+
+  ~SpscRing() {
+    delete[] cells_;
+  }
+
+  // Pushes 'item' and returns true, or returns false if the ring is full.
+  // Producer only.
+  bool Push(const T& item) {
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cached_head_ > mask_) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail - cached_head_ > mask_)
+        return false;
+    }
+    cells_[tail & mask_] = item;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Pops up to 'max' elements into 'results' and returns how many were
+  // popped. Consumer only.
+  int PopBatch(T* results, int max) {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    if (cached_tail_ == head) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (cached_tail_ == head)
+        return 0;
+    }
+    int n = cached_tail_ - head < static_cast<uint64_t>(max) ?
+            cached_tail_ - head : max;
+    for (int i = 0; i < n; i++)
+      results[i] = cells_[(head + i) & mask_];
+    head_.store(head + n, std::memory_order_release);
+    return n;
+  }
+
+ private:
+  T* cells_;
+  uint64_t mask_;
+
+  // Consumer's cache line: next position to read, and the last value of
+  // 'tail_' it saw.
+  char consumer_padding_[64];
+  std::atomic<uint64_t> head_;
+  uint64_t cached_tail_;
+
+  // Producer's cache line: next position to write, and the last value of
+  // 'head_' it saw.
+  char producer_padding_[64];
+  std::atomic<uint64_t> tail_;
+  uint64_t cached_head_;
+  char end_padding_[64];
+
+  // Rings are shared by address, so they cannot be copied.
+  SpscRing(const SpscRing&);
+  SpscRing& operator=(const SpscRing&);
+};
+
+/// @class FanInQueue<T>
+///
+/// Queue from numbered producer threads to a single consumer thread, made of
+/// one SpscRing per producer. Pushes from threads without a number, or that
+/// find their ring full, go to a shared AtomicQueue instead. Elements pushed
+/// by different producers come out in no particular order.
+template<typename T>
+class FanInQueue {
+ public:
+  // Producers are numbered 0 to 'producers' - 1.
+  explicit FanInQueue(int producers)
+      : pending_(false), next_ring_(0), next_(0), buffered_(0) {
+    for (int i = 0; i < producers; i++)
+      rings_.push_back(new SpscRing<T>());
+  }
+
+  ~FanInQueue() {
+    for (size_t i = 0; i < rings_.size(); i++)
+      delete rings_[i];
+  }
+
+  // Pushes 'item' on behalf of producer number 'producer', or of a thread
+  // that has no number if 'producer' is -1. Each producer number must only
+  // ever be used by one thread at a time.
+  void Push(int producer, const T& item) {
+    if (producer < 0 || producer >= static_cast<int>(rings_.size()) ||
+        !rings_[producer]->Push(item)) {
+      shared_.Push(item);
+      return;
+    }
+    // Pairs with the fence in 'Refill()': either the consumer's next sweep
+    // sees 'item', or this sees 'pending_' cleared and sets it again.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!pending_.load(std::memory_order_relaxed))
+      pending_.store(true, std::memory_order_relaxed);
+  }
+
+  // If the queue is non-empty, sets '*result' equal to an element, pops it
+  // and returns true, otherwise returns false. Consumer only.
+  bool Pop(T* result) {
+    if (next_ == buffered_) {
+      Refill();
+      if (buffered_ == 0)
+        return false;
+    }
+    *result = buffer_[next_++];
+    return true;
+  }
+
+  // Returns true if 'Pop()' would have found nothing at some point during
+  // the call. Consumer only.
+  bool Empty() {
+    return next_ == buffered_ && shared_.Size() == 0 &&
+           !pending_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // Most elements drained from one ring or the shared queue at a time, and
+  // the size of 'buffer_'.
+  static const int kBatch = 16;
+  static const int kBuffer = 8 * kBatch;
+
+  // Refills 'buffer_' with up to kBatch elements from the shared queue, and
+  // from each ring in turn, starting where the last refill left off. Rings
+  // are only swept if a producer has pushed since the last sweep.
+  // Requires: 'buffer_' is empty.
+  void Refill() {
+    next_ = 0;
+    buffered_ = shared_.PopBatch(buffer_, kBatch);
+    if (!pending_.load(std::memory_order_relaxed))
+      return;
+    pending_.store(false, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    int rings = rings_.size();
+    for (int i = 0; i < rings; i++) {
+      if (buffered_ + kBatch > kBuffer) {
+        // Out of room; sweep the rest next time.
+        pending_.store(true, std::memory_order_relaxed);
+        break;
+      }
+      int popped = rings_[next_ring_]->PopBatch(buffer_ + buffered_, kBatch);
+      if (popped == kBatch) {
+        // The ring may hold more.
+        pending_.store(true, std::memory_order_relaxed);
+      }
+      buffered_ += popped;
+      next_ring_ = (next_ring_ + 1) % rings;
+    }
+  }
+
+  std::vector<SpscRing<T>*> rings_;
+  AtomicQueue<T> shared_;
+
+  // Set by producers after pushing onto their rings, and cleared by the
+  // consumer before sweeping them. Producers only write it when it is clear,
+  // so it is written about once per sweep rather than once per push.
+  char pending_padding_[64];
+  std::atomic<bool> pending_;
+  char end_padding_[64];
+
+  // Consumer only: next ring to drain, and elements drained but not yet
+  // popped ('buffer_[next_]' to 'buffer_[buffered_ - 1]').
+  int next_ring_;
+  T buffer_[kBuffer];
+  int next_;
+  int buffered_;
+
+  // Queues are shared by address, so they cannot be copied.
+  FanInQueue(const FanInQueue&);
+  FanInQueue& operator=(const FanInQueue&);
+};
+
+#endif  // _DB_UTILS_SPSC_RING_H_
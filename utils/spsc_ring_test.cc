@@ -0,0 +1,140 @@
+#include "utils/spsc_ring.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <set>
+#include <vector>
+
+#include "txn/common.h"
+#include "utils/testing.h"
+
+// Has 'producers' threads each hand a timestamp to the calling thread every
+// 10us through a queue, the way workers hand completed txns to the
+// scheduler thread.
+template<typename Queue>
+class CompletionStress {
+ public:
+  explicit CompletionStress(int producers)
+      : producers_(producers), queue_(NewQueue(producers)), next_producer_(0),
+        stopped_(false) {}
+  ~CompletionStress() { delete queue_; }
+
+  // Polls the queue for 'seconds' like a scheduler loop. Returns the number
+  // of loop iterations per second, and sets '*latency' to the average time
+  // from push to pop.
+  double Run(double seconds, double* latency) {
+    vector<pthread_t> threads(producers_);
+    for (int i = 0; i < producers_; i++)
+      pthread_create(&threads[i], NULL, RunProducer, this);
+
+    uint64 iterations = 0;
+    uint64 popped = 0;
+    double total_latency = 0;
+    double t;
+    double start = GetTime();
+    double now = start;
+    while (now < start + seconds) {
+      iterations++;
+      while (queue_->Pop(&t)) {
+        total_latency += GetTime() - t;
+        popped++;
+      }
+      now = GetTime();
+    }
+
+    stopped_ = true;
+    for (int i = 0; i < producers_; i++)
+      pthread_join(threads[i], NULL);
+    *latency = popped ? total_latency / popped : 0;
+    return iterations / seconds;
+  }
+
+ private:
+  static void* RunProducer(void* arg) {
+    CompletionStress* c = reinterpret_cast<CompletionStress*>(arg);
+    int id = c->next_producer_++;
+    while (!c->stopped_) {
+      c->Push(id, GetTime());
+      usleep(10);
+    }
+    return NULL;
+  }
+
+  static Queue* NewQueue(int producers);
+  void Push(int producer, double t);
+
+  int producers_;
+  Queue* queue_;
+  std::atomic<int> next_producer_;
+  std::atomic<bool> stopped_;
+};
+
+template<>
+AtomicQueue<double>* CompletionStress<AtomicQueue<double> >::NewQueue(
+    int producers) {
+  return new AtomicQueue<double>();
+}
+template<>
+void CompletionStress<AtomicQueue<double> >::Push(int producer, double t) {
+  queue_->Push(t);
+}
+
+template<>
+FanInQueue<double>* CompletionStress<FanInQueue<double> >::NewQueue(
+    int producers) {
+  return new FanInQueue<double>(producers);
+}
+template<>
+void CompletionStress<FanInQueue<double> >::Push(int producer, double t) {
+  queue_->Push(producer, t);
+}
+
+TEST(FanInQueue_PopsEveryItem) {
+  FanInQueue<int> q(2);
+  // Producer 0 overflows its ring into the shared queue; -1 has no ring.
+  for (int i = 0; i < 300; i++)
+    q.Push(0, i);
+  q.Push(1, 300);
+  q.Push(-1, 301);
+
+  set<int> popped;
+  int item;
+  while (q.Pop(&item))
+    popped.insert(item);
+  EXPECT_EQ(302, popped.size());
+  EXPECT_EQ(0, *popped.begin());
+  EXPECT_EQ(301, *popped.rbegin());
+
+  END;
+}
+
+// Has 1 to 64 worker threads each complete a task every 10us, handing the
+// results to a scheduler loop through an AtomicQueue or a FanInQueue.
+// Prints scheduler loop iterations per second and average completion
+// latency (push to pop).
+void CompletionBenchmark() {
+  cout << "Completion queues (scheduler iterations/s, latency)" << endl;
+  cout << "workers\t\tatomic\t\t\t\tfan-in" << endl;
+  for (int workers = 1; workers <= 64; workers *= 2) {
+    double latency;
+    cout << workers << flush;
+
+    double iterations =
+        CompletionStress<AtomicQueue<double> >(workers).Run(1, &latency);
+    cout << "\t\t" << iterations << " (" << 1e6 * latency << "us)" << flush;
+
+    iterations =
+        CompletionStress<FanInQueue<double> >(workers).Run(1, &latency);
+    cout << "\t\t" << iterations << " (" << 1e6 * latency << "us)" << endl;
+  }
+}
+
+// Runs the tests, and the benchmark too if given '--bench'.
+int main(int argc, char** argv) {
+  FanInQueue_PopsEveryItem();
+
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+    CompletionBenchmark();
+}
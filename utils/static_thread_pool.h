@@ -5,105 +5,201 @@
 #define _DB_UTILS_STATIC_THREAD_POOL_H_
 
 #include "pthread.h"
+#include "stdint.h"
 #include "stdlib.h"
 #include "assert.h"
+#include "unistd.h"
 #include <queue>
 #include <string>
 #include <vector>
 #include "utils/atomic.h"
+#include "utils/cpu_topology.h"
+#include "utils/event_count.h"
 #include "utils/thread_pool.h"
+#include "utils/work_stealing_deque.h"
 
 using std::queue;
 using std::string;
 using std::vector;
 
-//
+/// @class StaticThreadPool
+///
+/// Fixed set of worker threads that share work by stealing. Each worker owns
+/// a WorkStealingDeque. Tasks a worker submits (e.g. those a scheduler loop
+/// running in the pool dispatches) go onto its own deque, from which it pops
+/// them LIFO. Tasks submitted from outside the pool go into a shared inbox.
+/// A worker with an empty deque takes from the inbox, and failing that
+/// steals from the top of other workers' deques, starting at a random one.
+/// Workers that find nothing sleep on an EventCount until a task is submitted.
 class StaticThreadPool : public ThreadPool {
  public:
-  StaticThreadPool(int nthreads)
-      : thread_count_(nthreads), queue_count_(nthreads), stopped_(false) {
+  explicit StaticThreadPool(int nthreads)
+      : thread_count_(nthreads), stopped_(false) {
     Start();
   }
 
-  StaticThreadPool(int nthreads, int nqueues)
-      : thread_count_(nthreads), queue_count_(nqueues), stopped_(false) {
+  // Like 'StaticThreadPool(nthreads)', but pins worker i to CPU
+  // 'cpus[i % cpus.size()]' (unless 'cpus' is empty).
+  StaticThreadPool(int nthreads, const vector<int>& cpus)
+      : thread_count_(nthreads), cpus_(cpus), stopped_(false) {
     Start();
   }
 
   ~StaticThreadPool() {
+    Stop();
+    for (int i = 0; i < thread_count_; i++)
+      delete workers_[i];
+  }
+
+  // Stops accepting new tasks from outside the pool, then waits for the
+  // workers to run every task already submitted (including any those tasks
+  // submit) and exit. Does nothing if the pool is already stopped.
+  void Stop() {
+    if (stopped_)
+      return;
     stopped_ = true;
+    work_.NotifyAll();
     for (int i = 0; i < thread_count_; i++)
-      pthread_join(threads_[i], NULL);
+      pthread_join(workers_[i]->thread, NULL);
   }
 
   bool Active() { return !stopped_; }
 
   virtual void RunTask(Task* task) {
-    assert(!stopped_);
-    while (!queues_[rand() % queue_count_].PushNonBlocking(task)) {}
+    RunTask(InlineTask(task));
+  }
+
+  // Like 'RunTask(Task*)', but the task is queued by value, so scheduling it
+  // does not allocate.
+  //
+  // Requires: the pool is not stopped, unless the caller is one of its own
+  // workers (i.e. a running task).
+  void RunTask(const InlineTask& task) {
+    Worker* self = CurrentWorker();
+    if (self != NULL && self->pool == this) {
+      // Even after 'Stop()', the worker drains its own deque before exiting.
+      self->deque.Push(task);
+    } else {
+      assert(!stopped_);
+      inbox_.Push(task);
+    }
+    work_.Notify();
   }
 
   virtual int ThreadCount() { return thread_count_; }
 
+  // Returns the index (from 0 to ThreadCount() - 1) of the worker running on
+  // the calling thread, or -1 if the caller is not one of this pool's
+  // workers.
+  int WorkerIndex() {
+    Worker* self = CurrentWorker();
+    return (self != NULL && self->pool == this) ? self->index : -1;
+  }
+
  private:
+  struct Worker {
+    Worker(StaticThreadPool* tp, int i)
+        : pool(tp), index(i), seed(2654435761u * (i + 1)) {}
+
+    StaticThreadPool* pool;
+    int index;
+    pthread_t thread;
+
+    // Tasks submitted by this worker.
+    WorkStealingDeque<InlineTask> deque;
+
+    // State of this worker's xorshift generator, used to pick victims.
+    uint32_t seed;
+
+    uint32_t Random() {
+      seed ^= seed << 13;
+      seed ^= seed >> 17;
+      seed ^= seed << 5;
+      return seed;
+    }
+  };
+
+  // Returns the worker running on the calling thread, or NULL if it is not
+  // a worker thread.
+  static Worker*& CurrentWorker() {
+    static __thread Worker* current = NULL;
+    return current;
+  }
+
   void Start() {
-    threads_.resize(thread_count_);
-    queues_.resize(queue_count_);
+    for (int i = 0; i < thread_count_; i++)
+      workers_.push_back(new Worker(this, i));
     for (int i = 0; i < thread_count_; i++) {
-      pthread_create(&threads_[i],
+      pthread_create(&workers_[i]->thread,
                      NULL,
                      RunThread,
-                     reinterpret_cast<void*>(this));
+                     reinterpret_cast<void*>(workers_[i]));
+      // If a worker cannot be pinned, the rest are not pinned either.
+      if (!cpus_.empty() &&
+          !PinThread(workers_[i]->thread, cpus_[i % cpus_.size()]))
+        cpus_.clear();
+    }
+  }
+
+  // Sets '*task' to the next task for 'self' to run, if it can find one.
+  bool FindTask(Worker* self, InlineTask* task) {
+    if (self->deque.Pop(task) || inbox_.Pop(task))
+      return true;
+    int start = self->Random() % thread_count_;
+    for (int i = 0; i < thread_count_; i++) {
+      Worker* victim = workers_[(start + i) % thread_count_];
+      if (victim != self && victim->deque.Steal(task))
+        return true;
     }
+    return false;
   }
 
   // Function executed by each pthread.
   static void* RunThread(void* arg) {
-    StaticThreadPool* tp = reinterpret_cast<StaticThreadPool*>(arg);
-    Task* task;
-    int sleep_duration = 1;  // in microseconds
+    Worker* self = reinterpret_cast<Worker*>(arg);
+    StaticThreadPool* tp = self->pool;
+    CurrentWorker() = self;
+    InlineTask task;
     while (true) {
-      if (tp->queues_[rand() % tp->queue_count_].PopNonBlocking(&task)) {
-        task->Run();
-        delete task;
-        // Reset backoff.
-        sleep_duration = 1;
-      } else {
-        usleep(sleep_duration);
-        // Back off exponentially.
-        if (sleep_duration < 32)
-          sleep_duration *= 2;
+      if (tp->FindTask(self, &task)) {
+        task.Run();
+        continue;
       }
 
-      if (tp->stopped_) {
-        // Go through ALL queues looking for a remaining task.
-        bool found_task = false;
-        int start = rand() % tp->queue_count_;
-        for (int i = 0; i < tp->queue_count_; i++) {
-          if (tp->queues_[(start + i) % tp->queue_count_].Pop(&task)) {
-            found_task = true;
-            task->Run();
-            delete task;
-            break;
-          }
-        }
-        if (!found_task) {
-          // All queues are empty.
-          break;
-        }
+      // Nothing to do. Look once more after registering as a waiter, so that
+      // a task submitted in between is not missed.
+      uint32_t key = tp->work_.PrepareWait();
+      if (tp->FindTask(self, &task)) {
+        tp->work_.CancelWait();
+        task.Run();
+      } else if (tp->stopped_) {
+        // Nothing is left anywhere we can see. Tasks still running on other
+        // workers only ever push onto their own deques, which they drain
+        // themselves before stopping.
+        tp->work_.CancelWait();
+        break;
+      } else {
+        tp->work_.Wait(key, -1);
       }
     }
     return NULL;
   }
 
   int thread_count_;
-  vector<pthread_t> threads_;
+  vector<Worker*> workers_;
+
+  // CPUs to pin workers to, if any.
+  vector<int> cpus_;
+
+  // Tasks submitted from threads outside the pool.
+  AtomicQueue<InlineTask> inbox_;
 
-  // Task queues.
-  int queue_count_;
-  vector<AtomicQueue<Task*> > queues_;
+  // Notified whenever a task is submitted, and when the pool stops.
+  EventCount work_;
 
-  bool stopped_;
+  // Set by 'Stop()'. Read by the workers and by tasks (e.g. through
+  // 'Active()') while they run.
+  std::atomic<bool> stopped_;
 };
 
 #endif  // _DB_UTILS_STATIC_THREAD_POOL_H_
@@ -0,0 +1,116 @@
+#include "utils/static_thread_pool.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#include "txn/common.h"
+#include "utils/testing.h"
+
+// Counts the tasks a thread pool runs. Tasks may submit more tasks.
+class TaskCounter {
+ public:
+  explicit TaskCounter(StaticThreadPool* tp) : tp_(tp), count_(0) {}
+
+  // Submits 10 tasks that each run 'Count(depth - 1)' (if 'depth' > 0), then
+  // counts this one.
+  void Count(int depth) {
+    for (int i = 0; depth > 0 && i < 10; i++)
+      tp_->RunTask(InlineTask(this, &TaskCounter::Count, depth - 1));
+    count_++;
+  }
+
+  // Waits for the pool to stop, then submits 'n' tasks that each count
+  // themselves, and counts this one.
+  void CountAfterStop(int n) {
+    while (tp_->Active())
+      usleep(10);
+    for (int i = 0; i < n; i++)
+      tp_->RunTask(InlineTask(this, &TaskCounter::Count, 0));
+    count_++;
+  }
+
+  // Waits up to 'timeout' seconds for 'n' tasks to have been counted, and
+  // returns the number that were.
+  int WaitFor(int n, double timeout) {
+    double deadline = GetTime() + timeout;
+    while (count_ < n && GetTime() < deadline)
+      usleep(10);
+    return count_;
+  }
+
+ private:
+  StaticThreadPool* tp_;
+  std::atomic<int> count_;
+};
+
+TEST(ThreadPool_RunsEveryTask) {
+  StaticThreadPool* tp = new StaticThreadPool(4);
+  TaskCounter counter(tp);
+
+  // Tasks submitted from outside the pool, both by value and on the heap.
+  for (int i = 0; i < 1000; i++)
+    tp->RunTask(InlineTask(&counter, &TaskCounter::Count, 0));
+  for (int i = 0; i < 1000; i++)
+    tp->RunTask(new Method<TaskCounter, void, int>(
+          &counter, &TaskCounter::Count, 0));
+
+  // Tasks submitted by tasks, which other workers have to steal.
+  tp->RunTask(InlineTask(&counter, &TaskCounter::Count, 3));
+
+  EXPECT_EQ(3111, counter.WaitFor(3111, 10));
+  delete tp;
+
+  END;
+}
+
+TEST(ThreadPool_StopRunsLateTasks) {
+  StaticThreadPool* tp = new StaticThreadPool(4);
+  TaskCounter counter(tp);
+
+  // A running task may still submit tasks once the pool is stopping, and
+  // 'Stop()' runs them before it returns.
+  tp->RunTask(InlineTask(&counter, &TaskCounter::CountAfterStop, 100));
+  tp->Stop();
+  EXPECT_EQ(101, counter.WaitFor(101, 0));
+  delete tp;
+
+  END;
+}
+
+// Runs empty tasks on thread pools of 1 to 64 workers, printing tasks run
+// per second. Tasks are either all submitted from outside the pool, or
+// submitted by other tasks in a tree with fanout 10.
+void ThreadPoolBenchmark() {
+  cout << "Thread pool task throughput (tasks/s)" << endl;
+  cout << "workers\t\texternal\tnested" << endl;
+  for (int workers = 1; workers <= 64; workers *= 2) {
+    StaticThreadPool* tp = new StaticThreadPool(workers);
+    cout << workers << flush;
+
+    TaskCounter external(tp);
+    double start = GetTime();
+    for (int i = 0; i < 111111; i++)
+      tp->RunTask(InlineTask(&external, &TaskCounter::Count, 0));
+    external.WaitFor(111111, 60);
+    cout << "\t\t" << 111111 / (GetTime() - start) << flush;
+
+    TaskCounter nested(tp);
+    start = GetTime();
+    tp->RunTask(InlineTask(&nested, &TaskCounter::Count, 5));
+    nested.WaitFor(111111, 60);
+    cout << "\t\t" << 111111 / (GetTime() - start) << endl;
+
+    delete tp;
+  }
+}
+
+// Runs the tests, and the benchmark too if given '--bench'.
+int main(int argc, char** argv) {
+  ThreadPool_RunsEveryTask();
+  ThreadPool_StopRunsLateTasks();
+
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+    ThreadPoolBenchmark();
+}
@@ -7,6 +7,7 @@
 #define _DB_UTILS_TASK_H_
 
 #include <cassert>
+#include <new>
 #include <queue>
 #include <string>
 #include <vector>
@@ -165,6 +166,67 @@ class Method : public RTask<R> {
   E e_;
 };
 
+/// @class InlineTask
+///
+/// A task held by value, so that thread pools can queue and run it without
+/// any heap allocation. An InlineTask either calls a void method with one
+/// arg, storing the object, method and arg inline, or wraps a heap-allocated
+/// Task, which it deletes after running it. InlineTasks are copied bytewise,
+/// so the arg must be plain data (e.g. a pointer or an integer).
+class InlineTask {
+ public:
+  InlineTask() : run_(NULL) {}
+
+  // Calls '(t->*f)(a)' when run.
+  template<class T, typename A>
+  InlineTask(T* t, void (T::*f)(A), A a) : run_(&RunCall<T, A>) {
+    static_assert(sizeof(Call<T, A>) <= sizeof(storage_.bytes),
+                  "method call does not fit in an InlineTask");
+    new (storage_.bytes) Call<T, A>(t, f, a);
+  }
+
+  // Runs 'task', then deletes it.
+  explicit InlineTask(Task* task) : run_(&RunHeapTask) {
+    new (storage_.bytes) Task*(task);
+  }
+
+  // Runs the task. Each task must be run at most once.
+  void Run() { run_(storage_.bytes); }
+
+  // Returns true if the task was default-constructed (and so cannot be run).
+  bool Empty() const { return run_ == NULL; }
+
+ private:
+  template<class T, typename A>
+  struct Call {
+    Call(T* t, void (T::*f)(A), A a) : t_(t), f_(f), a_(a) {}
+    T* t_;
+    void (T::*f_)(A);
+    A a_;
+  };
+
+  template<class T, typename A>
+  static void RunCall(char* bytes) {
+    Call<T, A>* call = reinterpret_cast<Call<T, A>*>(bytes);
+    (call->t_->*call->f_)(call->a_);
+  }
+
+  static void RunHeapTask(char* bytes) {
+    Task* task = *reinterpret_cast<Task**>(bytes);
+    task->Run();
+    delete task;
+  }
+
+  // Runs whatever is stored in 'storage_'.
+  void (*run_)(char*);
+
+  // Room for an object pointer, a method pointer and a pointer-sized arg.
+  union {
+    char bytes[4 * sizeof(void*)];
+    void* align;
+  } storage_;
+};
+
 ////////////////////////   Implementation details   ////////////////////////
 // TODO(alex): This should be moved to task.cc, but that seems to be causing
 //             compilation issues.
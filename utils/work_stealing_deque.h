@@ -0,0 +1,168 @@
+/// @file
+///
+/// Lock-free work-stealing deque (Chase and Lev, "Dynamic Circular
+/// Work-Stealing Deque", SPAA 2005, with the memory orderings of Le et al.,
+/// "Correct and Efficient Work-Stealing for Weak Memory Models", PPoPP 2013).
+///
+/// One owner thread pushes and pops at the bottom of the deque, LIFO, so the
+/// task it most recently created (and whose data is still in its cache) runs
+/// next. Any other thread may steal from the top, FIFO. Owner operations
+/// only synchronize with thieves when the deque is nearly empty.
+///
+/// Elements are copied in and out word by word with relaxed atomics, so T
+/// must be plain data (e.g. a pointer or an InlineTask). The deque grows when
+/// full. Arrays it has outgrown may still be read by a thief, so they are only
+/// freed along with the deque.
+
+#ifndef _DB_UTILS_WORK_STEALING_DEQUE_H_
+#define _DB_UTILS_WORK_STEALING_DEQUE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <vector>
+
+template<typename T>
+class WorkStealingDeque {
+ public:
+  // The deque starts out with room for 'capacity' elements, which must be a
+  // power of two.
+  explicit WorkStealingDeque(int64_t capacity = 256)
+      : top_(0), bottom_(0), array_(new Array(capacity)) {
+    arrays_.push_back(array_.load(std::memory_order_relaxed));
+  }
+
+  ~WorkStealingDeque() {
+    for (size_t i = 0; i < arrays_.size(); i++)
+      delete arrays_[i];
+  }
+
+  // Pushes 'item' onto the bottom of the deque. Owner only.
+  void Push(const T& item) {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_acquire);
+    Array* a = array_.load(std::memory_order_relaxed);
+    if (b - t > a->mask)
+      a = Grow(a, t, b);
+    a->Put(b, item);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+
+  // If the deque is non-empty, sets '*result' equal to the bottom (most
+  // recently pushed) element, removes it and returns true, otherwise returns
+  // false. Owner only.
+  bool Pop(T* result) {
+    int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    Array* a = array_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top_.load(std::memory_order_relaxed);
+    if (t > b) {
+      // Empty.
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return false;
+    }
+    a->Get(b, result);
+    if (t == b) {
+      // Last element: race any thief for it.
+      bool won = top_.compare_exchange_strong(t, t + 1,
+                                              std::memory_order_seq_cst,
+                                              std::memory_order_relaxed);
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return won;
+    }
+    return true;
+  }
+
+  // If the deque is non-empty, sets '*result' equal to the top (least
+  // recently pushed) element, removes it and returns true, otherwise returns
+  // false. May also return false if another thread got that element first.
+  // Any thread.
+  bool Steal(T* result) {
+    int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom_.load(std::memory_order_acquire);
+    if (t >= b)
+      return false;
+    Array* a = array_.load(std::memory_order_acquire);
+    a->Get(t, result);
+    return top_.compare_exchange_strong(t, t + 1,
+                                        std::memory_order_seq_cst,
+                                        std::memory_order_relaxed);
+  }
+
+  // Returns true if the deque looked empty at some point during the call.
+  bool Empty() const {
+    int64_t t = top_.load(std::memory_order_acquire);
+    int64_t b = bottom_.load(std::memory_order_acquire);
+    return t >= b;
+  }
+
+ private:
+  // Words needed to hold one element.
+  static const int kWords = (sizeof(T) + sizeof(uintptr_t) - 1) /
+                            sizeof(uintptr_t);
+
+  // Circular array of elements, indexed modulo its size.
+  struct Array {
+    explicit Array(int64_t size) : mask(size - 1), words(new Slot[size]) {}
+    ~Array() { delete[] words; }
+
+    struct Slot {
+      std::atomic<uintptr_t> word[kWords];
+    };
+
+    void Put(int64_t i, const T& item) {
+      uintptr_t buffer[kWords];
+      memcpy(buffer, &item, sizeof(T));
+      Slot& slot = words[i & mask];
+      for (int w = 0; w < kWords; w++)
+        slot.word[w].store(buffer[w], std::memory_order_relaxed);
+    }
+
+    void Get(int64_t i, T* item) const {
+      uintptr_t buffer[kWords];
+      const Slot& slot = words[i & mask];
+      for (int w = 0; w < kWords; w++)
+        buffer[w] = slot.word[w].load(std::memory_order_relaxed);
+      memcpy(static_cast<void*>(item), buffer, sizeof(T));
+    }
+
+    int64_t mask;
+    Slot* words;
+  };
+
+  // Replaces 'a', which holds the elements from 't' to 'b', with an array
+  // twice its size. Owner only.
+  Array* Grow(Array* a, int64_t t, int64_t b) {
+    Array* bigger = new Array(2 * (a->mask + 1));
+    for (int64_t i = t; i < b; i++) {
+      T item;
+      a->Get(i, &item);
+      bigger->Put(i, item);
+    }
+    arrays_.push_back(bigger);
+    array_.store(bigger, std::memory_order_release);
+    return bigger;
+  }
+
+  // Thieves and the owner contend on 'top_', while 'bottom_' is written only
+  // by the owner. Padding keeps them on separate cache lines, so that owner
+  // pushes do not invalidate the line thieves spin on.
+  std::atomic<int64_t> top_;
+  char top_padding_[64];
+  std::atomic<int64_t> bottom_;
+  char bottom_padding_[64];
+  std::atomic<Array*> array_;
+
+  // Every array this deque has used, including the current one.
+  std::vector<Array*> arrays_;
+
+  // Deques are shared by address, so they cannot be copied.
+  WorkStealingDeque(const WorkStealingDeque&);
+  WorkStealingDeque& operator=(const WorkStealingDeque&);
+};
+
+#endif  // _DB_UTILS_WORK_STEALING_DEQUE_H_